@@ -22,18 +22,20 @@ public:
 
   // generic encrypt / decrypt
   Ciphertext encrypt(bool plaintext) const;
-  bool decrypt(Ciphertext ciphertext) const;
+  bool decrypt(const Ciphertext& ciphertext) const;
 
   // encrypt / decrypt binary strings
-  std::vector<Ciphertext> encrypt(BitString plaintext) const;
-  BitString decrypt(std::vector<Ciphertext> ciphertexts) const;
+  std::vector<Ciphertext> encrypt(const BitString& plaintext) const;
+  BitString decrypt(const std::vector<Ciphertext>& ciphertexts) const;
 
   // homomorphic operations
-  Ciphertext add(Ciphertext c1, Ciphertext c2) const;
-  Ciphertext add(Ciphertext c1, bool p) const;
+  Ciphertext add(const Ciphertext& c1, const Ciphertext& c2) const;
+  Ciphertext add(const Ciphertext& c1, bool p) const;
 
   // sending over the network
-  void send(std::vector<Ciphertext> ciphertexts, Channel channel, bool compress = false);
+  void send(
+    const std::vector<Ciphertext>& ciphertexts, Channel channel, bool compress = false
+  );
   std::vector<Ciphertext> receive(size_t n, Channel channel, bool compress = false);
 
   // check if a point is zero
@@ -1,16 +1,23 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <iostream>
+#include <span>
 
 #include "util/bitstring.hpp"
 #include "util/params.hpp"
 
 namespace LPN {
 
+class DenseMatrix;
+
 // abstract class that encapsulates basic binary matrix operations
 class Matrix {
 public:
+  virtual ~Matrix() = default;
+
   // element access
   virtual bool operator[](std::pair<size_t, size_t> idx) const = 0;
 
@@ -23,6 +30,15 @@ public:
   // matrix vector multiplication
   virtual BitString operator*(const BitString& other) const = 0;
 
+  // xor row `idx` into `acc` (without copying the row out where possible)
+  virtual void xorRow(size_t idx, BitString& acc) const { acc ^= (*this)[idx]; }
+
+  // compute (this · otherᵀ) where `other` is given as a list of rows
+  virtual DenseMatrix gram(const std::vector<BitString>& other) const;
+
+  // xor of the columns at indices `cols`, i.e. this matrix times the vector that is one
+  //  exactly at `cols`
+  virtual BitString sumColumns(const std::vector<size_t>& cols) const;
 };
 
 class MatrixProduct;
@@ -39,14 +55,27 @@ public:
   BitString operator[](size_t idx) const override;
   std::pair<size_t, size_t> dim() const override;
   BitString operator*(const BitString& other) const override;
+  void xorRow(size_t idx, BitString& acc) const override { acc ^= (*rows)[idx]; }
+  DenseMatrix gram(const std::vector<BitString>& other) const override;
+  BitString sumColumns(const std::vector<size_t>& cols) const override;
+
+  // transposed matrix vector multiplication (thisᵀ · other), i.e. the xor of the rows
+  //  selected by `other`
+  BitString transposeTimes(const BitString& other) const;
+
+  // matrix multiplication using the method of four russians
+  DenseMatrix operator*(const DenseMatrix& other) const;
 
   // for debugging
   std::string toString() const;
 
+  friend class Matrix;
   friend class SparseMatrix;
 protected:
   DenseMatrix(size_t height, size_t width)
     : width(width), rows(std::make_shared<std::vector<BitString>>(height)) { }
+  DenseMatrix(std::vector<BitString>&& rows, size_t width)
+    : width(width), rows(std::make_shared<std::vector<BitString>>(std::move(rows))) { }
 
   // using shared pointer to prevent duplication in memory
   std::shared_ptr<std::vector<BitString>> rows;
@@ -56,6 +85,9 @@ protected:
 // matrix with a constant number of non-zero elements per row
 class SparseMatrix : public Matrix {
 public:
+  // fills in the non-zero points of row `idx` in sorted order
+  using RowGenerator = std::function<void(size_t idx, uint32_t* row)>;
+
   SparseMatrix() { }
   // basic operations
   bool operator[](std::pair<size_t, size_t> idx) const override;
@@ -63,8 +95,12 @@ public:
   std::pair<size_t, size_t> dim() const override;
   BitString operator*(const BitString& other) const override;
 
-  // directly get non-zero points
-  std::vector<uint32_t> getNonZeroElements(size_t idx) const { return (*points)[idx]; }
+  // directly get non-zero points; rows of implicit matrices are regenerated into a buffer
+  //  per thread so the span only lasts until the next call on the same thread
+  std::span<const uint32_t> getNonZeroElements(size_t idx) const {
+    if (!points) { return generate(idx); }
+    return std::span<const uint32_t>(points.get() + idx * weight, weight);
+  }
 
   // matrix multiplication
   MatrixProduct operator*(const DenseMatrix& other) const;
@@ -75,53 +111,160 @@ public:
   friend class DenseMatrix;
 protected:
   // just sets up initial fields
-  SparseMatrix(size_t height, size_t width)
-    : width(width), points(std::make_shared<std::vector<std::vector<uint32_t>>>(height)) { }
+  SparseMatrix(size_t height, size_t width, size_t weight)
+    : height(height), width(width), weight(weight),
+      points(store(std::vector<uint32_t>(height * weight))) { }
+
+  // sets up an implicit matrix where no points are stored and rows come from `generator`
+  SparseMatrix(size_t height, size_t width, size_t weight, RowGenerator generator)
+    : height(height), width(width), weight(weight), generator(std::move(generator)) { }
 
-  // all non-zero points (using shared pointer to prevent duplication in memory)
-  std::shared_ptr<std::vector<std::vector<uint32_t>>> points;
+  // regenerate row `idx` of an implicit matrix
+  std::span<const uint32_t> generate(size_t idx) const;
+
+  // hand over `points` to be shared as the matrix's storage
+  static std::shared_ptr<const uint32_t> store(std::vector<uint32_t>&& points) {
+    auto owner = std::make_shared<std::vector<uint32_t>>(std::move(points));
+    return std::shared_ptr<const uint32_t>(owner, owner->data());
+  }
+
+  // all non-zero points stored row after row with `weight` per row (using shared pointer
+  //  to prevent duplication in memory, which also lets them live in a mapped file)
+  std::shared_ptr<const uint32_t> points;
+  size_t height;
   size_t width;
+  size_t weight;
+
+  // how rows are made when not stored
+  RowGenerator generator;
 };
 
 class PrimalMatrix : public SparseMatrix {
 public:
-  PrimalMatrix() : SparseMatrix(0, 0), key(0) { };
-  PrimalMatrix(const BitString& key, const PrimalParams& params);
+  PrimalMatrix() : SparseMatrix(0, 0, 0), key(0) { };
+
+  // the rows are all computed up front unless `implicit`, in which case each is regenerated
+  //  from `key` whenever it is used
+  PrimalMatrix(const BitString& key, const PrimalParams& params, bool implicit = false);
 
   // just samples a key and returns a matrix; mostly for testing
-  static PrimalMatrix sample(const PrimalParams& params);
+  static PrimalMatrix sample(const PrimalParams& params, bool implicit = false);
+
+  // map the matrix for `key` and `params` from the cache in `dir`, first generating it and
+  //  writing it there if it is missing or fails its checksum
+  static PrimalMatrix cached(
+    const std::string& dir, const BitString& key, const PrimalParams& params
+  );
 private:
   BitString key;
 };
 
 class DualMatrix : public DenseMatrix {
 public:
-  DualMatrix() : DenseMatrix(), key(0) { };
+  DualMatrix() : DenseMatrix(), key(0), transposed(std::make_shared<Transposed>()) { };
+
   DualMatrix(const BitString& key, const DualParams& params);
 
   // just samples a key and returns a matrix; mostly for testing
   static DualMatrix sample(const DualParams& params);
+
+  // read the matrix for `key` and `params` from the cache in `dir`, first generating it and
+  //  writing it there if it is missing or fails its checksum
+  static DualMatrix cached(
+    const std::string& dir, const BitString& key, const DualParams& params
+  );
+
+  // the columns of the matrix as bitstrings of length k (transposed in full the first time
+  //  this is called, which doubles the memory the matrix takes up)
+  const std::vector<BitString>& columns() const;
+
+  // only transposes the 64-column strips that `cols` falls in and xors together whole
+  //  columns out of those
+  BitString sumColumns(const std::vector<size_t>& cols) const override;
 private:
   BitString key;
+
+  // column-major copy (using shared pointer so copies of the matrix share it too)
+  struct Transposed {
+    std::once_flag once;
+    std::vector<BitString> columns;
+  };
+  std::shared_ptr<Transposed> transposed;
+};
+
+// dual matrix made of ⌈N / n⌉ circulant n × n blocks side by side (the last cut short), so
+//  only the first row of each block is stored and every other row is a rotation of it
+class QuasiCyclicMatrix : public Matrix {
+public:
+  QuasiCyclicMatrix() : height(0), width(0), key(0) { }
+  QuasiCyclicMatrix(const BitString& key, const DualParams& params);
+
+  // just samples a key and returns a matrix; mostly for testing
+  static QuasiCyclicMatrix sample(const DualParams& params);
+
+  // basic operations
+  bool operator[](std::pair<size_t, size_t> idx) const override;
+  BitString operator[](size_t idx) const override;
+  std::pair<size_t, size_t> dim() const override;
+  BitString operator*(const BitString& other) const override;
+  void xorRow(size_t idx, BitString& acc) const override;
+
+  // for debugging
+  std::string toString() const;
+protected:
+  // the first row of each block written out twice so any rotation is a single substring
+  //  (using shared pointer to prevent duplication in memory)
+  std::shared_ptr<std::vector<BitString>> blocks;
+  size_t height;
+  size_t width;
+  BitString key;
 };
 
 class MatrixProduct {
 public:
   MatrixProduct() { }
-  MatrixProduct(SparseMatrix sparse, DenseMatrix dense) : sparse(sparse), dense(dense) {
-    if (sparse.dim().second != dense.dim().first) {
+  MatrixProduct(SparseMatrix sparse, std::shared_ptr<const Matrix> dense)
+    : sparse(sparse), dense(dense)
+  {
+    if (sparse.dim().second != dense->dim().first) {
       throw std::domain_error("[MatrixProduct] matrix dimensions mismatched");
     }
   }
+  MatrixProduct(SparseMatrix sparse, DenseMatrix dense)
+    : MatrixProduct(sparse, std::make_shared<DenseMatrix>(dense)) { }
 
   std::pair<size_t, size_t> dim() const {
-    return std::make_pair(sparse.dim().first, dense.dim().second);
+    return std::make_pair(sparse.dim().first, dense->dim().second);
   }
 
   BitString operator[](size_t idx) const;
+
+  // compute the first `rows` rows up front so they are copied out rather than rebuilt from
+  //  `dense` on every access
+  void materialize(size_t rows);
+  size_t materialized() const { return this->cachedRows; }
+
+  // the same but through the cache in `dir`: rows saved there under `key` are mapped rather
+  //  than recomputed, and otherwise they are computed and saved there (`key` has to pin down
+  //  both matrices, e.g. both seeds along with the parameters)
+  void materialize(size_t rows, const std::string& dir, const BitString& key);
+
+  // write out the materialized rows tagged with `key`, or read back rows that were saved
+  //  under the same `key` from a product of the same shape
+  void save(std::ostream& out, const BitString& key) const;
+  void load(std::istream& in, const BitString& key);
 private:
+  // xor together the rows of `dense` picked out by row `idx` of `sparse`
+  BitString compute(size_t idx) const;
+
   SparseMatrix sparse;
-  DenseMatrix dense;
+  std::shared_ptr<const Matrix> dense;
+
+  // materialized rows stored one after the other, each padded out to whole words (using
+  //  shared pointer to prevent duplication in memory, which also lets them live in a mapped
+  //  file)
+  std::shared_ptr<const uint64_t> cache;
+  size_t cachedRows = 0;
 };
 
 }
@@ -28,7 +28,7 @@ public:
 
   // initialize / clear public information
   void init();
-  void clear() { A = LPN::PrimalMatrix(); H = LPN::DualMatrix(); B = LPN::MatrixProduct(); };
+  void clear() { A = LPN::PrimalMatrix(); H.reset(); B = LPN::MatrixProduct(); };
 
   // non-interactive steps to prepare for the protocol
   virtual void prepare() = 0;
@@ -55,12 +55,19 @@ protected:
     const std::vector<AHE::Ciphertext>& enc_s
   ) const;
 
+  // compute the rows of B up front if `params` asks for it and they aren't already
+  void materializeProduct();
+
+  // compute shares of ⟨bᵢ⊗ aᵢ,ε ⊗ s⟩ for each output (see `Expansion`)
+  BitString expandDirect() const;
+  BitString expandGram() const;
+
   PCGParams params;
   AHE ahe;
 
   // public matrices
   LPN::PrimalMatrix A;
-  LPN::DualMatrix H;
+  std::shared_ptr<const LPN::Matrix> H;
   LPN::MatrixProduct B; // = AH
 
   // primal lpn secret vectors & errors
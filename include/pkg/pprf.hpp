@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <utility>
 #include <tuple>
 
@@ -7,22 +8,51 @@
 #include "util/bitstring.hpp"
 #include "util/concurrency.hpp"
 
+// how a parent node is expanded into its children
+enum class TreeMode {
+  GGM,      // both children from the length-doubling prg, two aes calls per node
+  HALFTREE  // left child from a correlation-robust hash and right = left ⊕ parent
+};
+
 // P(unctured) P(seudo)R(andom) F(unction)
 class PPRF {
 public:
+  // receives the `n` consecutive leafs of tree `tree` starting at leaf `offset`, packed one
+  //  after another in ⌈outsize / 8⌉ bytes each
+  using LeafSink = std::function<void(size_t tree, size_t offset, const uint8_t* leafs, size_t n)>;
+
   PPRF() { }
 
-  // initialize given the root `key`
-  PPRF(BitString key, size_t outsize, size_t domainsize);
+  // initialize given the root `key` (nodes are aes blocks so at most 128 bits)
+  PPRF(
+    const BitString& key, size_t outsize, size_t domainsize,
+    TreeMode mode = TreeMode::GGM
+  );
+
+  // initialize given the root `key` handing the leafs to `sink` as tree `tree` rather than
+  //  holding onto them, so the pprf can be sent but not evaluated
+  PPRF(
+    const BitString& key, size_t outsize, size_t domainsize, const LeafSink& sink,
+    size_t tree, TreeMode mode = TreeMode::GGM
+  );
 
   // initialize the pprf which has been punctured at `puncture`
   PPRF(
-    std::vector<BitString> keys, uint32_t puncture, size_t outsize, size_t domainsize
+    std::vector<BitString> keys, uint32_t puncture, size_t outsize, size_t domainsize,
+    TreeMode mode = TreeMode::GGM
   );
 
   // create `n` pprfs with a single puncture point with randomly sampled keys
   static std::vector<PPRF> sample(
-    size_t n, size_t keysize, size_t outsize, size_t domainsize
+    size_t n, size_t keysize, size_t outsize, size_t domainsize,
+    TreeMode mode = TreeMode::GGM
+  );
+
+  // as above but the leafs of pprf i are handed to `sink` (from several threads at once)
+  //  as tree i
+  static std::vector<PPRF> sample(
+    size_t n, size_t keysize, size_t outsize, size_t domainsize, const LeafSink& sink,
+    TreeMode mode = TreeMode::GGM
   );
 
   // evaluate the pprf on `x`
@@ -31,6 +61,15 @@ public:
   // expand a pprf that has been shared
   void expand();
 
+  // expand all of `pprfs` (which must have the same shape) a level at a time together so
+  //  the aes batches span trees rather than just the few nodes near each root
+  static void expand(std::vector<PPRF>& pprfs);
+
+  // expand all of `pprfs` handing their leafs to `sink` (from several threads at once) a
+  //  chunk at a time instead of holding onto them; each punctured leaf is zero in its chunk
+  //  and is handed over on its own once the rest of its tree is done
+  static void expand(std::vector<PPRF>& pprfs, const LeafSink& sink);
+
   std::shared_ptr<std::vector<BitString>> getImage() const { return leafs; }
   size_t domain() const { return domainsize; }
   void clear() { leafs.reset(); levels.clear(); keys.clear(); }
@@ -40,13 +79,18 @@ public:
 
   // share across `channel` punctured according to `points` with output `payload`
   static void send(
-    std::vector<PPRF> pprf, BitString payload, Channel channel, ROT::Sender rots
+    const std::vector<PPRF>& pprfs, const BitString& payload, Channel channel,
+    ROT::Sender rots
   );
   static std::vector<PPRF> receive(
-    std::vector<uint32_t> points, size_t keysize, size_t outsize, size_t domainsize,
-    Channel channel, ROT::Receiver rots
+    const std::vector<uint32_t>& points, size_t keysize, size_t outsize, size_t domainsize,
+    Channel channel, ROT::Receiver rots, TreeMode mode = TreeMode::GGM
   );
 protected:
+  // expand the `n` pprfs starting at `pprfs` with a small group of trees interleaved at a
+  //  time, streaming the leafs to `sink` numbered from `first` if given
+  static void expand(PPRF* pprfs, size_t n, const LeafSink* sink = nullptr, size_t first = 0);
+
   std::vector<std::pair<BitString, BitString>> levels;
   std::shared_ptr<std::vector<BitString>> leafs;
 
@@ -54,6 +98,7 @@ protected:
   size_t domainsize;
   size_t outsize;
   size_t depth;
+  TreeMode mode;
 
   // whether we've done whole domain evaluation
   bool expanded;
@@ -68,18 +113,32 @@ class BitPPRF {
 public:
   BitPPRF() { }
 
-  // initialize given the root `key`
-  BitPPRF(BitString key, size_t domainsize);
+  // initialize given the root `key` (nodes are aes blocks so at most 128 bits); domains
+  //  past 128 are packed so each leaf is a bundle of 128 outputs
+  BitPPRF(const BitString& key, size_t domainsize, TreeMode mode = TreeMode::GGM);
 
   // initialize the pprf which has been punctured at `x`
-  BitPPRF(std::vector<BitString> keys, uint32_t point);
+  BitPPRF(std::vector<BitString> keys, uint32_t point, TreeMode mode = TreeMode::GGM);
+
+  // initialize the packed pprf which has been punctured at `x`, with the `correction` keys
+  //  that place the output within its bundle
+  BitPPRF(
+    std::vector<BitString> keys, std::vector<BitString> correction, uint32_t point,
+    TreeMode mode = TreeMode::GGM
+  );
 
   // create `n` pprfs with randomly sampled keys
-  static std::vector<BitPPRF> sample(size_t n, size_t keysize, size_t domainsize);
+  static std::vector<BitPPRF> sample(
+    size_t n, size_t keysize, size_t domainsize, TreeMode mode = TreeMode::GGM
+  );
 
   // expand a pprf that has been shared
   void expand();
 
+  // expand all of `pprfs` (which must have the same shape) a level at a time together so
+  //  the aes batches span trees rather than just the few nodes near each root
+  static void expand(std::vector<BitPPRF>& pprfs);
+
   // the truth table for the function
   BitString image() const {
     if (!this->expanded) {
@@ -89,20 +148,31 @@ public:
   }
 
   size_t domain() const { return domainsize; }
-  void clear() { _image.reset(); levels.clear(); keys.clear(); }
+  void clear() { _image.reset(); correction.reset(); levels.clear(); keys.clear(); }
 
   // share across `channel` punctured according to `points` with outputs `payloads`
   static void send(
-    std::vector<BitPPRF> pprfs, BitString payloads, Channel channel, ROT::Sender rots
+    const std::vector<BitPPRF>& pprfs, const BitString& payloads, Channel channel,
+    ROT::Sender rots
   );
 
   static std::vector<BitPPRF> receive(
-    std::vector<uint32_t> points, size_t keysize, size_t domainsize,
-    Channel channel, ROT::Receiver rots
+    const std::vector<uint32_t>& points, size_t keysize, size_t domainsize,
+    Channel channel, ROT::Receiver rots, TreeMode mode = TreeMode::GGM
   );
 protected:
+  // expand the `n` pprfs starting at `pprfs` with a small group of trees interleaved at a
+  //  time
+  static void expand(BitPPRF* pprfs, size_t n);
+
+  // append the ot messages to share this pprf with output `payload` at the puncture
+  void appendMessages(bool payload, std::vector<std::pair<BitString, BitString>>& messages) const;
+
   std::shared_ptr<BitString> _image;
 
+  // when packed, the pprf over the punctured bundle's outputs that carries the payload
+  std::shared_ptr<BitPPRF> correction;
+
   // information required to send
   std::vector<std::pair<BitString, BitString>> levels;
 
@@ -113,6 +183,7 @@ protected:
   size_t keysize;
   size_t domainsize;
   size_t depth;
+  TreeMode mode;
 
   // whether we've done whole domain evaluation
   bool expanded;
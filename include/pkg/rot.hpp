@@ -22,9 +22,10 @@ public:
       last(std::make_shared<size_t>(0)) { }
 
   Base(std::vector<T> ots)
-    : results(std::make_shared<std::vector<T>>(ots)),
-      first(std::make_shared<size_t>(0)),
-      last(std::make_shared<size_t>(ots.size())) { }
+    : first(std::make_shared<size_t>(0)),
+      last(std::make_shared<size_t>(ots.size())) {
+    this->results = std::make_shared<std::vector<T>>(std::move(ots));
+  }
 
   // consume a single random ot with `size` bits and return it
   virtual T get(size_t size = DEFAULT_ELEMENT_SIZE) = 0;
@@ -56,7 +57,7 @@ public:
 
   // use these random ots to perform some number of normal ots
   void transfer(
-    std::vector<std::pair<BitString, BitString>> messages, Channel channel
+    const std::vector<std::pair<BitString, BitString>>& messages, Channel channel
   );
 
   // use these random ots to perform some number of normal bit-ots
@@ -88,16 +89,16 @@ public:
 
   // use these random ots to perform some number of normal ots with the same size
   std::vector<BitString> transfer(
-    BitString choices, size_t mbits, Channel channel
+    const BitString& choices, size_t mbits, Channel channel
   );
 
   // use these random ots to perform some number of normal ots with different size
   std::vector<BitString> transfer(
-    BitString choices, std::vector<size_t> mbits, Channel channel
+    const BitString& choices, const std::vector<size_t>& mbits, Channel channel
   );
 
   // use these random ots to perform some number of normal bit-ots
-  BitString transfer(BitString choices, Channel channel);
+  BitString transfer(const BitString& choices, Channel channel);
 
   // reserve n ots in another object (e.g., to give to a threaded process)
   Receiver reserve(size_t n) {
@@ -1,24 +1,109 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+class BitStringView;
+
+// vector of 64-bit words that keeps up to INLINE_WORDS words inside the object itself
+//  so that LAMBDA-bit strings (tree nodes, ot messages, keys) never touch the allocator
+class WordBuffer {
+public:
+  static constexpr size_t INLINE_WORDS = 2;
+
+  WordBuffer() : size_(0), capacity_(INLINE_WORDS) { }
+  explicit WordBuffer(size_t n) : WordBuffer() { resize(n); }
+  WordBuffer(const WordBuffer& other) : WordBuffer() { *this = other; }
+  WordBuffer(WordBuffer&& other) noexcept : WordBuffer() { *this = std::move(other); }
+  ~WordBuffer() { if (onHeap()) { delete[] heap; } }
+
+  WordBuffer& operator=(const WordBuffer& other) {
+    if (this != &other) {
+      size_ = 0;
+      reserve(other.size_);
+      size_ = other.size_;
+      std::memcpy(data(), other.data(), size_ * sizeof(uint64_t));
+    }
+    return *this;
+  }
+
+  WordBuffer& operator=(WordBuffer&& other) noexcept {
+    if (this == &other) { return *this; }
+    if (!other.onHeap()) {
+      // inline words have to be copied, but there are only a couple
+      size_ = other.size_;
+      std::memcpy(data(), other.data(), size_ * sizeof(uint64_t));
+    } else {
+      if (onHeap()) { delete[] heap; }
+      heap = other.heap;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.capacity_ = INLINE_WORDS;
+    }
+    other.size_ = 0;
+    return *this;
+  }
+
+  size_t size() const { return size_; }
+  uint64_t* data() { return onHeap() ? heap : local; }
+  const uint64_t* data() const { return onHeap() ? heap : local; }
+  uint64_t& operator[](size_t i) { return data()[i]; }
+  const uint64_t& operator[](size_t i) const { return data()[i]; }
+  uint64_t& back() { return data()[size_ - 1]; }
+  void clear() { size_ = 0; }
+
+  // make room for `n` words without changing the size
+  void reserve(size_t n) {
+    if (n <= capacity_) { return; }
+    uint64_t* grown = new uint64_t[n];
+    std::memcpy(grown, data(), size_ * sizeof(uint64_t));
+    if (onHeap()) { delete[] heap; }
+    heap = grown;
+    capacity_ = n;
+  }
+
+  // like std::vector, any new words are zeroed
+  void resize(size_t n) {
+    if (n > capacity_) { reserve(std::max(n, 2 * capacity_)); }
+    if (n > size_) { std::memset(data() + size_, 0, (n - size_) * sizeof(uint64_t)); }
+    size_ = n;
+  }
+private:
+  bool onHeap() const { return capacity_ > INLINE_WORDS; }
+
+  union {
+    uint64_t local[INLINE_WORDS];
+    uint64_t* heap;
+  };
+  size_t size_;
+  size_t capacity_;
+};
+
 class BitString {
 protected:
-  std::vector<unsigned char> bytes;
+  // bits are packed little-endian into 64-bit words so bitwise operations can work a
+  //  whole word (or vector register) at a time
+  WordBuffer words;
   size_t size_;
+
+  // number of words needed to hold `size` bits
+  static size_t nWords(size_t size) { return (size + 63) / 64; }
 private:
   // private class to allow for bit setting
   class BitReference {
   public:
-    BitReference(std::vector<unsigned char>& bytes, size_t pos) : bytes_(bytes), pos_(pos) { }
+    BitReference(WordBuffer& words, size_t pos) : words_(words), pos_(pos) { }
 
     BitReference& operator=(bool value) {
       if (value) {
-        bytes_[pos_ / 8] |= (1 << (pos_ % 8));   // Set the bit
+        words_[pos_ / 64] |= (uint64_t(1) << (pos_ % 64));   // Set the bit
       } else {
-        bytes_[pos_ / 8] &= ~(1 << (pos_ % 8));  // Clear the bit
+        words_[pos_ / 64] &= ~(uint64_t(1) << (pos_ % 64));  // Clear the bit
       }
       return *this;
     }
@@ -29,39 +114,37 @@ private:
     }
 
     BitReference& operator^=(bool other) {
-      bool ours = (bytes_[pos_ / 8] >> (pos_ % 8)) & 0x01;
-      this->operator=(ours ^ other);
+      words_[pos_ / 64] ^= (uint64_t(other) << (pos_ % 64));
       return *this;
     }
 
     BitReference& operator&=(bool other) {
-      bool ours = (bytes_[pos_ / 8] >> (pos_ % 8)) & 0x01;
-      this->operator=(ours & other);
+      if (!other) { this->operator=(false); }
       return *this;
     }
 
     BitReference& operator|=(bool other) {
-      bool ours = (bytes_[pos_ / 8] >> (pos_ % 8)) & 0x01;
-      this->operator=(ours | other);
+      words_[pos_ / 64] |= (uint64_t(other) << (pos_ % 64));
       return *this;
     }
 
     operator bool() const {
-      return (bytes_[pos_ / 8] >> (pos_ % 8)) & 0x01;
+      return (words_[pos_ / 64] >> (pos_ % 64)) & 0x01;
     }
 
   private:
-    std::vector<unsigned char>& bytes_;
+    WordBuffer& words_;
     size_t pos_;
   };
 public:
-  BitString() : bytes(0), size_(0) { }
-  BitString(size_t size) : bytes((size + 7) / 8), size_(size) { }
-  BitString(std::vector<unsigned char> bytes) : bytes(bytes), size_(bytes.size() * 8) { }
-  BitString(std::vector<unsigned char> bytes, size_t size) : bytes(bytes), size_(size) { }
-  BitString(const BitString& other) : bytes(other.bytes), size_(other.size_) { }
-  BitString(unsigned char* bytes, size_t size)
-    : bytes(bytes, bytes + ((size + 7) / 8)), size_(size) { }
+  BitString() : size_(0) { }
+  BitString(size_t size) : words(nWords(size)), size_(size) { }
+  BitString(std::vector<unsigned char> bytes);
+  BitString(std::vector<unsigned char> bytes, size_t size);
+  BitString(const BitString& other) : words(other.words), size_(other.size_) { }
+  BitString(BitString&& other) noexcept
+    : words(std::move(other.words)), size_(other.size_) { other.size_ = 0; }
+  BitString(unsigned char* bytes, size_t size);
 
   // serialize and deserialize
   static BitString fromUInt(const uint32_t& value, size_t bits = 32);
@@ -70,6 +153,7 @@ public:
 
   // allows variable assignment
   BitString& operator=(const BitString& other);
+  BitString& operator=(BitString&& other) noexcept;
 
   // get & set the ith bit
   const bool operator[](size_t i) const;
@@ -77,47 +161,67 @@ public:
     if (i >= size_) {
       throw std::out_of_range("[BitString] " + std::to_string(i) + " is out of range");
     }
-    return BitReference(bytes, i);
+    return BitReference(words, i);
   }
 
   // get a substring
   BitString operator[](std::pair<size_t, size_t> range) const;
 
+  // get a substring [from, to) without copying (only valid while this bitstring is)
+  BitStringView view(size_t from, size_t to) const;
+
   // concatenation operators
   BitString& operator+=(const BitString& other);
-  BitString  operator+ (const BitString& other) const;
+  BitString  operator+ (const BitString& other) const &;
+  BitString  operator+ (const BitString& other) &&;
   BitString& operator+=(const bool& bit);
-  static BitString concat(const std::vector<BitString> in);
+  static BitString concat(const std::vector<BitString>& in);
 
   // comparison operators
   bool operator==(const BitString& other) const;
   bool operator!=(const BitString& other) const;
   bool operator<(const BitString& other) const;
 
-  // bitwise operators manipulating the underlying bytes
+  // bitwise operators manipulating the underlying words (the rvalue overloads reuse the
+  //  left operand's storage for the result, e.g. in `a ^ b ^ c`)
   BitString& operator^=(const BitString& other);
-  BitString  operator^ (const BitString& other) const;
+  BitString& operator^=(const BitStringView& other);
+  BitString  operator^ (const BitString& other) const &;
+  BitString  operator^ (const BitString& other) &&;
   BitString& operator&=(const BitString& other);
-  BitString  operator& (const BitString& other) const;
+  BitString  operator& (const BitString& other) const &;
+  BitString  operator& (const BitString& other) &&;
   BitString& operator|=(const BitString& other);
-  BitString  operator| (const BitString& other) const;
+  BitString  operator| (const BitString& other) const &;
+  BitString  operator| (const BitString& other) &&;
   BitString  operator~ () const;
 
   // bitwise inner product
   bool operator*(const BitString& other) const;
 
+  // inner product with each of the `n` bitstrings in `others` (out[j] = ⟨this,others[j]⟩)
+  BitString innerProducts(const BitString* others, size_t n) const;
+  BitString innerProducts(const std::vector<BitString>& others) const {
+    return innerProducts(others.data(), others.size());
+  }
+
   // tensor product (for testing)
   BitString tensor(const BitString& other) const;
 
   // to mirror vector access
   size_t size() const { return size_; }
-  unsigned char* data() { return bytes.data(); }
-  std::vector<unsigned char>::iterator begin() { return bytes.begin(); }
-  std::vector<unsigned char>::iterator end() { return bytes.end(); }
-  void clear() { bytes.clear(); size_ = 0; }
+  unsigned char* data() { return reinterpret_cast<unsigned char*>(words.data()); }
+  const unsigned char* data() const {
+    return reinterpret_cast<const unsigned char*>(words.data());
+  }
+  unsigned char* begin() { return data(); }
+  unsigned char* end() { return data() + nBytes(); }
+  void clear() { words.clear(); size_ = 0; }
 
-  size_t nBytes() const { return bytes.size(); }
-  std::vector<unsigned char> toBytes() const { return bytes; }
+  size_t nBytes() const { return (size_ + 7) / 8; }
+  std::vector<unsigned char> toBytes() const {
+    return std::vector<unsigned char>(data(), data() + nBytes());
+  }
 
   // gets hamming weight of the bit string
   size_t weight() const;
@@ -131,9 +235,15 @@ public:
   // conver to a byte vector where each bit is expanded to a whole byte
   std::vector<unsigned char> expand();
 
+  // preallocate space for `size` bits (e.g., before many concatenations)
+  void reserve(size_t size) { words.reserve(nWords(size)); }
+
   void resize(size_t size) {
     this->size_ = size;
-    bytes.resize((size + 7) / 8);
+    words.resize(nWords(size));
+
+    // clear anything left over past the end when shrinking
+    if (size % 64 != 0) { words.back() &= lastWordMask(); }
   }
 
   // using this as a key, expand to `size` bits using aes
@@ -149,10 +259,55 @@ public:
   std::string toString() const;
   std::string toHexString() const;
   friend std::ostream& operator<<(std::ostream& os, const BitString& bs);
+
+  friend class BitStringView;
+private:
+  // mask of the bits in the last word that are actually part of the bitstring
+  uint64_t lastWordMask() const {
+    return (size_ % 64 == 0) ? ~uint64_t(0) : (uint64_t(1) << (size_ % 64)) - 1;
+  }
 };
 
 std::ostream& operator<<(std::ostream& os, const BitString& bs);
 
+// read-only window onto a range of bits in a BitString that does not own any memory
+class BitStringView {
+public:
+  BitStringView(const BitString& bs) : BitStringView(bs, 0, bs.size()) { }
+  BitStringView(const BitString& bs, size_t offset, size_t size)
+    : words(bs.words.data()), nwords(bs.words.size()), offset(offset), size_(size) { }
+
+  size_t size() const { return size_; }
+
+  // get the ith bit
+  bool operator[](size_t i) const {
+    if (i >= size_) {
+      throw std::out_of_range(
+        "[BitStringView::operator[]] " + std::to_string(i) + " is out of range"
+      );
+    }
+    return (words[(offset + i) / 64] >> ((offset + i) % 64)) & 0x01;
+  }
+
+  // the ith 64 bits of the view shifted down to be word aligned (bits past the end are 0)
+  uint64_t word(size_t i) const;
+  size_t nWords() const { return (size_ + 63) / 64; }
+
+  // comparison, inner product, and hamming weight without copying
+  bool operator==(const BitStringView& other) const;
+  bool operator!=(const BitStringView& other) const { return !this->operator==(other); }
+  bool operator*(const BitStringView& other) const;
+  size_t weight() const;
+
+  // copy out into an owning bitstring
+  BitString toBitString() const;
+private:
+  const uint64_t* words;
+  size_t nwords;
+  size_t offset;
+  size_t size_;
+};
+
 // our error correcting code for lpn encryption
 namespace ECC {
 BitString encode(const BitString& message);
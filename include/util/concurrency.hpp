@@ -26,16 +26,19 @@ T TASK_REDUCE(
   // for cases where concurrency doesn't make sense
   if (num_tasks < 8 * THREAD_COUNT) { return combine(std::vector<T>{task(0, num_tasks)}); }
 
-  std::vector<std::future<T>> futures(THREAD_COUNT);
-  std::vector<T> results(THREAD_COUNT);
-
-  for (size_t thread_id = 0; thread_id < THREAD_COUNT; thread_id++) {
-    size_t start = thread_id * ((num_tasks + THREAD_COUNT - 1) / THREAD_COUNT);
-    size_t end = std::min(start + ((num_tasks + THREAD_COUNT - 1) / THREAD_COUNT), num_tasks);
-    futures[thread_id] = std::async(std::launch::async, task, start, end);
+  std::vector<std::future<T>> futures;
+
+  // rounding the chunk size up can leave the last threads with nothing to do, so only
+  //  non-empty ranges are handed out
+  size_t chunk = (num_tasks + THREAD_COUNT - 1) / THREAD_COUNT;
+  for (size_t start = 0; start < num_tasks; start += chunk) {
+    futures.push_back(
+      std::async(std::launch::async, task, start, std::min(start + chunk, num_tasks))
+    );
   }
 
-  for (size_t i = 0; i < THREAD_COUNT; i++) {
+  std::vector<T> results(futures.size());
+  for (size_t i = 0; i < futures.size(); i++) {
     results[i] = futures[i].get();
   }
 
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// a whole file mapped read-only into memory, which stays mapped for as long as any copy of
+//  the pointer from `open` is alive
+class MappedFile {
+public:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  // map the file at `path`, or return null if it cannot be opened
+  static std::shared_ptr<const MappedFile> open(const std::string& path);
+
+  const unsigned char* data() const { return bytes; }
+  size_t size() const { return length; }
+private:
+  MappedFile(unsigned char* bytes, size_t length) : bytes(bytes), length(length) { }
+
+  unsigned char* bytes;
+  size_t length;
+};
+
+// 64 bit checksum of `n` bytes; chunks are hashed on separate threads but the result does
+//  not depend on the thread count
+uint64_t checksum(const unsigned char* bytes, size_t n);
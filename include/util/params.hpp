@@ -3,6 +3,7 @@
 #include <cmath>
 #include <stdexcept>
 #include <iomanip> // For std::fixed and std::setprecision
+#include <string>
 
 #include "util/bitstring.hpp"
 
@@ -79,6 +80,19 @@ public:
 
 }
 
+// how the final correlations are computed from the public matrices
+enum class Expansion {
+  AUTO,   // pick whichever is expected to be cheaper for the parameters
+  DIRECT, // compute each output from the rows of A·H and A·(ε ⊗ s)
+  GRAM    // precompute H·(ε ⊗ s)ᵀ and compute each output with lookups
+};
+
+// family of code used for the dual lpn matrix H
+enum class DualCode {
+  DENSE,       // uniformly random and stored in full
+  QUASI_CYCLIC // circulant blocks so only one row per block is stored
+};
+
 class PCGParams {
 public:
   PCGParams(
@@ -110,6 +124,21 @@ public:
   // TODO: what should this value be?
   size_t eqTestThreshold = 3;
 
+  // strategy used in expansion
+  Expansion expansion = Expansion::AUTO;
+
+  // whether the primal matrix rows are regenerated when used rather than stored
+  bool implicitPrimal = false;
+
+  // code family for the dual matrix
+  DualCode dualCode = DualCode::DENSE;
+
+  // whether the rows of B = A·H used in expansion are computed once before it starts
+  bool materializeProduct = false;
+
+  // directory the public lpn matrices are cached in between runs (none if empty)
+  std::string cacheDir;
+
   size_t blocks() {
     return (size_t) ceil((float) size / primal.blockSize());
   }
@@ -6,6 +6,7 @@
 
 #include <cryptoTools/Common/block.h>
 #include <cryptoTools/Crypto/AES.h>
+#include <cryptoTools/Crypto/PRNG.h>
 
 #include "util/bitstring.hpp"
 #include "util/defines.hpp"
@@ -13,7 +14,7 @@
 template<typename T>
 class PRF {
 public:
-  PRF(BitString key) : aes(osuCrypto::toBlock(key.data())) { this->setKey(key.toBytes()); }
+  PRF(const BitString& key) : aes(osuCrypto::toBlock(key.data())) { this->setKey(key.toBytes()); }
 
   T operator()(uint32_t x) const;
   T operator()(std::pair<uint32_t, uint32_t> x) const;
@@ -22,6 +23,13 @@ public:
   T operator()(uint32_t x, uint32_t bound) const;
   T operator()(std::pair<uint32_t, uint32_t> x, uint32_t bound) const;
 
+  // batched versions writing the output for each of the `n` inputs in `x` to `out` (these
+  //  keep several aes blocks in flight at once so prefer them for many evaluations)
+  void operator()(const uint32_t* x, size_t n, uint32_t bound, T* out) const;
+  void operator()(
+    const std::pair<uint32_t, uint32_t>* x, size_t n, uint32_t bound, T* out
+  ) const;
+
   void setKey(const std::vector<unsigned char>& key) {
     if (key.size() > BLOCK_SIZE) {
       throw std::invalid_argument("[PRF::setKey] provided key too large");
@@ -36,13 +44,32 @@ private:
 
   osuCrypto::AES aes;
 
-  // generic version that can be used by templated functions
-  T operator()(BitString x, uint32_t bound) const;
-
   // aes block size
   const size_t BLOCK_SIZE = 16;
 };
 
+// buffered aes counter-mode generator seeded once per thread from the os; all of the
+//  sampling helpers below (and BitString::sample) draw from it
+class CSPRNG {
+public:
+  // the calling thread's instance
+  static CSPRNG& local();
+
+  // fill `bytes` bytes at `out` with uniform randomness
+  void fill(unsigned char* out, size_t bytes) { prng.get<unsigned char>(out, bytes); }
+
+  // uniformly sample `size` bits
+  BitString sampleBits(size_t size);
+
+  // uniformly sample a value less than `max` (or `n` of them into `out`)
+  uint32_t lessThan(uint32_t max);
+  void lessThan(uint32_t* out, size_t n, uint32_t max);
+private:
+  CSPRNG();
+
+  osuCrypto::PRNG prng;
+};
+
 // simple class to sample bits without running AES for each one
 class BitSampler {
 public:
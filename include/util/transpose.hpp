@@ -1,3 +1,15 @@
 #pragma once
 
-std::vector<BitString> transpose(std::vector<PPRF>& pprfs, const PCGParams& params);
+#include <vector>
+
+#include "pkg/pprf.hpp"
+#include "util/bitstring.hpp"
+#include "util/params.hpp"
+
+// transpose the matrix whose rows are `rows` (each at least `ncols` bits)
+std::vector<BitString> transpose(const std::vector<BitString>& rows, size_t ncols);
+
+// a sink for PPRF::expand that writes the leafs of the (ε ⊗ s) pprfs straight into their
+//  columns of `output`, which must already hold params.primal.k zeroed rows of
+//  params.dual.N() bits
+PPRF::LeafSink transposeSink(std::vector<BitString>& output, const PCGParams& params);
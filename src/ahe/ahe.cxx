@@ -48,12 +48,12 @@ AHE::Ciphertext AHE::encrypt(bool plaintext) const {
   return this->encrypt(bs)[0];
 }
 
-bool AHE::decrypt(AHE::Ciphertext ciphertext) const {
+bool AHE::decrypt(const AHE::Ciphertext& ciphertext) const {
   std::vector<AHE::Ciphertext> vector({ciphertext});
   return this->decrypt(vector)[0];
 }
 
-std::vector<AHE::Ciphertext> AHE::encrypt(BitString plaintext) const {
+std::vector<AHE::Ciphertext> AHE::encrypt(const BitString& plaintext) const {
   REccNumber zero;
   bn_zero(zero);
 
@@ -75,7 +75,7 @@ std::vector<AHE::Ciphertext> AHE::encrypt(BitString plaintext) const {
       }
       return out;
     }, [](std::vector<std::vector<AHE::Ciphertext>> ciphertexts) {
-      std::vector<AHE::Ciphertext> out = ciphertexts[0];
+      std::vector<AHE::Ciphertext> out = std::move(ciphertexts[0]);
       for (size_t i = 1; i < ciphertexts.size(); i++) {
         out.insert(out.end(), ciphertexts[i].begin(), ciphertexts[i].end());
       }
@@ -83,7 +83,7 @@ std::vector<AHE::Ciphertext> AHE::encrypt(BitString plaintext) const {
   }, plaintext.size());
 }
 
-BitString AHE::decrypt(std::vector<AHE::Ciphertext> ciphertexts) const {
+BitString AHE::decrypt(const std::vector<AHE::Ciphertext>& ciphertexts) const {
   return TASK_REDUCE<BitString>([this, &ciphertexts](size_t start, size_t end) {
     REllipticCurve curve; // initialize relic on the thread
     BitString out(end - start);
@@ -96,11 +96,11 @@ BitString AHE::decrypt(std::vector<AHE::Ciphertext> ciphertexts) const {
   }, BitString::concat, ciphertexts.size());
 }
 
-AHE::Ciphertext AHE::add(AHE::Ciphertext c1, AHE::Ciphertext c2) const {
+AHE::Ciphertext AHE::add(const AHE::Ciphertext& c1, const AHE::Ciphertext& c2) const {
   return std::make_pair(c1.first + c2.first, c1.second + c2.second);
 }
 
-AHE::Ciphertext AHE::add(AHE::Ciphertext c, bool p) const {
+AHE::Ciphertext AHE::add(const AHE::Ciphertext& c, bool p) const {
   if (!p) { return c; }
   else    { return std::make_pair(c.first, c.second + this->one); }
 }
@@ -113,7 +113,9 @@ bool AHE::isZero(const REccPoint& point) const {
 // NETWORK METHODS
 ////////////////////////////////////////////////////////////////////////////////
 
-void AHE::send(std::vector<AHE::Ciphertext> ciphertexts, Channel channel, bool compress) {
+void AHE::send(
+  const std::vector<AHE::Ciphertext>& ciphertexts, Channel channel, bool compress
+) {
 
   if (compress) {
     auto key = this->prf.getKey();
@@ -9,6 +9,7 @@
 #include "pkg/rot.hpp"
 #include "util/bitstring.hpp"
 #include "util/defines.hpp"
+#include "util/random.hpp"
 #include "util/timer.hpp"
 
 #define BASE_PORT 3200
@@ -202,6 +203,23 @@ int main(int argc, char *argv[]) {
     (
       "td", options::value<unsigned>()->default_value(32),
       "dual LPN error vector weight"
+    )
+    (
+      "implicit", options::bool_switch(),
+      "regenerate primal LPN matrix rows when used instead of storing them"
+    )
+    ("quasiCyclic", options::bool_switch(), "use a quasi-cyclic dual LPN matrix")
+    (
+      "materialize", options::bool_switch(),
+      "compute the rows of the LPN matrix product once before expansion"
+    )
+    (
+      "seed", options::value<unsigned>(),
+      "derive the public LPN matrix seeds from this instead of sampling them"
+    )
+    (
+      "cache", options::value<std::string>()->default_value(""),
+      "directory to cache the public LPN matrices in between runs (requires --seed)"
     );
 
   try {
@@ -234,11 +252,29 @@ int main(int argc, char *argv[]) {
 
     if (logC == 0) { logC = logN; }
 
+    // cached matrices are named by their seeds, so fresh seeds would never hit the cache
+    std::string cacheDir = vm["cache"].as<std::string>();
+    if (!cacheDir.empty() && !vm.count("seed")) {
+      std::cerr << "[protocol] --cache needs --seed to reuse matrices between runs" << std::endl;
+      return 1;
+    }
+
+    BitString pkey = BitString::sample(LAMBDA), dkey = BitString::sample(LAMBDA);
+    if (vm.count("seed")) {
+      BitString seed = BitString::fromUInt(vm["seed"].as<unsigned>());
+      seed.resize(LAMBDA);
+      PRF<BitString> prf(seed);
+      pkey = prf(0, LAMBDA);
+      dkey = prf(1, LAMBDA);
+    }
+
     PCGParams params(
-      1 << logC,
-      BitString::sample(LAMBDA), 1 << logN, 1 << logk, 1 << logtp, l,
-      BitString::sample(LAMBDA), c, td
+      1 << logC, pkey, 1 << logN, 1 << logk, 1 << logtp, l, dkey, c, td
     );
+    params.implicitPrimal = vm["implicit"].as<bool>();
+    if (vm["quasiCyclic"].as<bool>()) { params.dualCode = DualCode::QUASI_CYCLIC; }
+    params.materializeProduct = vm["materialize"].as<bool>();
+    params.cacheDir = cacheDir;
 
     if (both) {
       runBoth(params);
@@ -30,6 +30,7 @@ BitString EqTest::run(std::vector<uint32_t> inputs) {
 
   for (size_t i = 0, j = this->length; j > this->threshold; i++, j = (size_t) ceil(log2(j + 1))) {
     BitString x;
+    x.reserve(j * this->tests);
     for (size_t t = 0; t < this->tests; t++) {
       x += reduced[t] ^ rsi[t][i];
     }
@@ -46,7 +47,7 @@ BitString EqTest::run(std::vector<uint32_t> inputs) {
     // compute next iteration of `x`
     BitString z = x ^ y;
     for (size_t t = 0; t < this->tests; t++) {
-      BitString zt = z[{j * t, j * (t + 1)}];
+      BitStringView zt = z.view(j * t, j * (t + 1));
       inputs[t] = 0;
       for (size_t l = 0; l < j; l++) {
         inputs[t] = (inputs[t] + (zt[l] ? (j + 1) - abi[t][i][l] : abi[t][i][l])) % (j + 1);
@@ -186,6 +187,8 @@ void EqTestSender::productSharing() {
   size_t bits = (1 << this->threshold) - 2;
   BitString x;
   BitString a;
+  x.reserve(bits * tests);
+  a.reserve(bits * tests);
   for (size_t t = 0; t < tests; t++) {
     this->rs[t] = BitString::sample(bits);
     this->ab[t] = BitString::sample(bits);
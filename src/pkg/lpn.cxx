@@ -1,15 +1,101 @@
 #include "pkg/lpn.hpp"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <thread>
 
+#include <boost/filesystem.hpp>
+
 #include "util/concurrency.hpp"
 #include "util/defines.hpp"
+#include "util/mapped.hpp"
 #include "util/random.hpp"
+#include "util/transpose.hpp"
 
 namespace LPN {
 
+namespace {
+
+// raw access to the words of a bitstring (bits past its size are unspecified)
+const uint64_t* words(const BitString& bits) {
+  return reinterpret_cast<const uint64_t*>(bits.data());
+}
+uint64_t* words(BitString& bits) { return reinterpret_cast<uint64_t*>(bits.data()); }
+
+// xor of columns `cols` for rows [`start`, `end`) with `bit(i, c)` giving each entry
+template<typename Bit>
+BitString sumColumnsRange(size_t start, size_t end, const std::vector<size_t>& cols, Bit bit) {
+  BitString out(end - start);
+  uint64_t* acc = words(out);
+  for (size_t i = start; i < end; i++) {
+    uint64_t sum = 0;
+    for (size_t c : cols) { sum ^= bit(i, c); }
+    acc[(i - start) / 64] |= sum << ((i - start) % 64);
+  }
+  return out;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MATRIX
+////////////////////////////////////////////////////////////////////////////////
+
+DenseMatrix Matrix::gram(const std::vector<BitString>& other) const {
+  const size_t height = this->dim().first, width = this->dim().second;
+  for (const BitString& row : other) {
+    if (row.size() != width) {
+      throw std::domain_error("[Matrix::gram] matrix dimensions mismatched");
+    }
+  }
+
+  // rows are made a batch at a time and then swept against tiles of `other` like the dense
+  //  version does
+  const size_t BATCH = 64, TILE = 64;
+
+  DenseMatrix out(height, other.size());
+  MULTI_TASK([this, &other, &out, height](size_t start, size_t end) {
+    std::vector<BitString> rows;
+    for (size_t batch = start; batch < end; batch += BATCH) {
+      size_t stop = std::min(batch + BATCH, end);
+      rows.clear();
+      for (size_t i = batch; i < stop; i++) {
+        rows.push_back((*this)[i]);
+        (*out.rows)[i] = BitString(other.size());
+      }
+
+      for (size_t tile = 0; tile < other.size(); tile += TILE) {
+        size_t last = std::min(tile + TILE, other.size());
+        for (size_t i = batch; i < stop; i++) {
+          BitString products = rows[i - batch].innerProducts(&other[tile], last - tile);
+          for (size_t j = tile; j < last; j++) {
+            if (products[j - tile]) { (*out.rows)[i][j] = true; }
+          }
+        }
+      }
+    }
+  }, height);
+
+  return out;
+}
+
+BitString Matrix::sumColumns(const std::vector<size_t>& cols) const {
+  for (size_t c : cols) {
+    if (c >= this->dim().second) {
+      throw std::domain_error("[Matrix::sumColumns] column out of range");
+    }
+  }
+  return TASK_REDUCE<BitString>([this, &cols](size_t start, size_t end) {
+    return sumColumnsRange(start, end, cols, [this](size_t i, size_t c) {
+      return uint64_t((*this)[{i, c}]);
+    });
+  }, BitString::concat, this->dim().first);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // DENSE MATRIX
 ////////////////////////////////////////////////////////////////////////////////
@@ -45,11 +131,112 @@ BitString DenseMatrix::operator*(const BitString& other) const {
   if (this->dim().second != other.size()) {
     throw std::domain_error("[DenseMatrix::operator*(BitString)] vector dimension mismatched");
   }
-  BitString result(this->dim().first);
-  for (size_t i = 0; i < (*this->rows).size(); i++) {
-    result[i] = (*this->rows)[i] * other;
+  return TASK_REDUCE<BitString>([this, &other](size_t start, size_t end) {
+    return other.innerProducts(this->rows->data() + start, end - start);
+  }, BitString::concat, this->rows->size());
+}
+
+BitString DenseMatrix::transposeTimes(const BitString& other) const {
+  if (this->rows->size() != other.size()) {
+    throw std::domain_error("[DenseMatrix::transposeTimes] vector dimension mismatched");
+  }
+  return TASK_REDUCE<BitString>([this, &other](size_t start, size_t end) {
+    BitString acc(this->width);
+    for (size_t i = start; i < end; i++) {
+      if (other[i]) { acc ^= (*this->rows)[i]; }
+    }
+    return acc;
+  }, [this](const std::vector<BitString>& parts) {
+    BitString acc(this->width);
+    for (const BitString& part : parts) { acc ^= part; }
+    return acc;
+  }, this->rows->size());
+}
+
+BitString DenseMatrix::sumColumns(const std::vector<size_t>& cols) const {
+  for (size_t c : cols) {
+    if (c >= this->width) {
+      throw std::domain_error("[DenseMatrix::sumColumns] column out of range");
+    }
+  }
+  return TASK_REDUCE<BitString>([this, &cols](size_t start, size_t end) {
+    return sumColumnsRange(start, end, cols, [this](size_t i, size_t c) {
+      return (words((*this->rows)[i])[c / 64] >> (c % 64)) & 1;
+    });
+  }, BitString::concat, this->rows->size());
+}
+
+// the method of four russians: for each group of 8 columns of this matrix all 256 sums of
+//  the matching 8 rows of `other` are tabulated, so each of our rows then takes one lookup
+//  per group rather than 8 row additions; work is split into blocks of our rows by stripes
+//  of output words so a table stays in L1 while the rows sharing it are swept
+DenseMatrix DenseMatrix::operator*(const DenseMatrix& other) const {
+  if (this->width != other.rows->size()) {
+    throw std::domain_error(
+      "[DenseMatrix::operator*(DenseMatrix)] matrix dimensions mismatched"
+    );
+  }
+
+  const size_t GROUP = 8, STRIPE = 8, ROW_BLOCK = 2048;
+  const size_t height = this->rows->size(), inner = this->width, outWidth = other.width;
+  const size_t outWords = (outWidth + 63) / 64;
+  const size_t nstripes = (outWords + STRIPE - 1) / STRIPE;
+  const size_t nblocks = (height + ROW_BLOCK - 1) / ROW_BLOCK;
+  const uint64_t lastMask = (outWidth % 64 == 0) ? ~0ull : (1ull << (outWidth % 64)) - 1;
+
+  DenseMatrix out(height, outWidth);
+  MULTI_TASK([&out, height, outWidth](size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) { (*out.rows)[i] = BitString(outWidth); }
+  }, height);
+
+  MULTI_TASK([&](size_t start, size_t end) {
+    std::vector<uint64_t> table((1 << GROUP) * STRIPE);
+    for (size_t task = start; task < end; task++) {
+      const size_t stripe = task % nstripes, block = task / nstripes;
+      const size_t w0 = stripe * STRIPE, nw = std::min(STRIPE, outWords - w0);
+      const size_t r0 = block * ROW_BLOCK, r1 = std::min(r0 + ROW_BLOCK, height);
+
+      for (size_t g = 0; g < inner; g += GROUP) {
+        const size_t bits = std::min(GROUP, inner - g);
+
+        // entry e is entry (e with its lowest set bit cleared), which comes earlier, plus
+        //  the row for that lowest bit, so each entry costs one row addition
+        std::fill(table.begin(), table.begin() + nw, 0);
+        for (size_t e = 1; e < (1ull << bits); e++) {
+          const size_t b = __builtin_ctzll(e);
+          const uint64_t* row = words((*other.rows)[g + b]) + w0;
+          const uint64_t* prev = &table[(e & (e - 1)) * STRIPE];
+          uint64_t* entry = &table[e * STRIPE];
+          for (size_t w = 0; w < nw; w++) { entry[w] = prev[w] ^ row[w]; }
+        }
+
+        const uint64_t groupMask = (1ull << bits) - 1;
+        for (size_t i = r0; i < r1; i++) {
+          const size_t idx = (words((*this->rows)[i])[g / 64] >> (g % 64)) & groupMask;
+          if (idx == 0) { continue; }
+          const uint64_t* entry = &table[idx * STRIPE];
+          uint64_t* acc = words((*out.rows)[i]) + w0;
+          for (size_t w = 0; w < nw; w++) { acc[w] ^= entry[w]; }
+        }
+      }
+
+      if (w0 + nw == outWords) {
+        for (size_t i = r0; i < r1; i++) { words((*out.rows)[i])[outWords - 1] &= lastMask; }
+      }
+    }
+  }, nstripes * nblocks);
+
+  return out;
+}
+
+// (this · otherᵀ) is a plain product once `other` is transposed
+DenseMatrix DenseMatrix::gram(const std::vector<BitString>& other) const {
+  for (const BitString& row : other) {
+    if (row.size() != this->width) {
+      throw std::domain_error("[DenseMatrix::gram] matrix dimensions mismatched");
+    }
   }
-  return result;
+  return (*this) * DenseMatrix(transpose(other, this->width), other.size());
 }
 
 std::string DenseMatrix::toString() const {
@@ -65,28 +252,27 @@ std::string DenseMatrix::toString() const {
 ////////////////////////////////////////////////////////////////////////////////
 
 bool SparseMatrix::operator[](std::pair<size_t, size_t> idx) const {
-  if (idx.first >= (*this->points).size() || idx.second >= this->width) {
+  if (idx.first >= this->height || idx.second >= this->width) {
     throw std::domain_error("[SparseMatrix::operator[](std::pair)] idx out of range");
   }
-  return std::find(
-    (*this->points)[idx.first].begin(), (*this->points)[idx.first].end(), idx.second
-  ) != (*this->points)[idx.first].end();
+  std::span<const uint32_t> row = this->getNonZeroElements(idx.first);
+  return std::find(row.begin(), row.end(), idx.second) != row.end();
 }
 
 BitString SparseMatrix::operator[](size_t idx) const {
-  if (idx >= (*this->points).size()) {
+  if (idx >= this->height) {
     throw std::domain_error("[SparseMatrix::operator[](size_t)] idx out of range");
   }
 
   BitString row(this->width);
-  for (uint32_t i : (*this->points)[idx]) {
+  for (uint32_t i : this->getNonZeroElements(idx)) {
     row[i] = true;
   }
   return row;
 }
 
 std::pair<size_t, size_t> SparseMatrix::dim() const {
-  return std::make_pair((*this->points).size(), this->width);
+  return std::make_pair(this->height, this->width);
 }
 
 MatrixProduct SparseMatrix::operator*(const DenseMatrix& other) const {
@@ -102,49 +288,328 @@ BitString SparseMatrix::operator*(const BitString& other) const {
   if (this->dim().second != other.size()) {
     throw std::domain_error("[SparseMatrix::operator*(BitString)] vector dimension mismatched");
   }
-  BitString result(this->dim().first);
-  for (size_t i = 0; i < (*this->points).size(); i++) {
-    for (uint32_t point : (*this->points)[i]) {
-      if (other[point]) { result[i] ^= other[point]; }
+  const uint64_t* vec = words(other);
+  return TASK_REDUCE<BitString>([this, vec](size_t start, size_t end) {
+    BitString out(end - start);
+    uint64_t* acc = words(out);
+    for (size_t i = start; i < end; i++) {
+      uint64_t sum = 0;
+      for (uint32_t point : this->getNonZeroElements(i)) {
+        sum ^= vec[point / 64] >> (point % 64);
+      }
+      acc[(i - start) / 64] |= (sum & 1) << ((i - start) % 64);
     }
+    return out;
+  }, BitString::concat, this->height);
+}
+
+std::span<const uint32_t> SparseMatrix::generate(size_t idx) const {
+  if (!this->generator) {
+    throw std::runtime_error("[SparseMatrix::generate] matrix has no points");
   }
-  return result;
+  thread_local std::vector<uint32_t> row;
+  row.resize(this->weight);
+  this->generator(idx, row.data());
+  return std::span<const uint32_t>(row.data(), this->weight);
 }
 
 std::string SparseMatrix::toString() const {
   std::string out;
-  for (size_t i = 0; i < (*this->points).size(); i++) {
+  for (size_t i = 0; i < this->height; i++) {
     out += this->operator[](i).toString() + "\n";
   }
   return out;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// CACHE
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// cached matrices are a header, then the key they were made from padded out to whole words
+//  and then the payload: the points of a primal matrix or the rows of a dual matrix or a
+//  matrix product each padded out to whole words (bump the version whenever either layout
+//  or the way matrices are generated changes)
+const char CACHE_MAGIC[8] = { 'F', '2', 'O', 'L', 'E', 'L', 'P', 'N' };
+const uint32_t CACHE_VERSION = 2;
+
+enum class CacheKind : uint32_t { PRIMAL = 1, DUAL = 2, PRODUCT = 3 };
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  CacheKind kind;
+  uint64_t tag;       // hash of the key and dimensions, which only names the file
+  uint64_t dims[4];
+  uint64_t keyBits;
+  uint64_t payload;   // in bytes
+  uint64_t checksum;  // of the payload
+};
+static_assert(sizeof(CacheHeader) % sizeof(uint64_t) == 0, "key should stay word aligned");
+
+// the key's bits with everything past its size cleared
+std::vector<uint64_t> keyWords(const BitString& key) {
+  std::vector<uint64_t> words((key.size() + 63) / 64);
+  std::memcpy(words.data(), key.data(), (key.size() + 7) / 8);
+  if (key.size() % 64 != 0) { words.back() &= (1ull << (key.size() % 64)) - 1; }
+  return words;
+}
+
+size_t payloadOffset(const CacheHeader& header) {
+  return sizeof(CacheHeader) + (header.keyBits + 63) / 64 * sizeof(uint64_t);
+}
+
+CacheHeader cacheHeader(
+  CacheKind kind, const BitString& key, std::vector<uint64_t> dims, uint64_t payload
+) {
+  if (dims.size() > 4) { throw std::invalid_argument("[LPN::cacheHeader] too many dims"); }
+
+  CacheHeader header = { };
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  header.kind = kind;
+  std::copy(dims.begin(), dims.end(), header.dims);
+  header.keyBits = key.size();
+  header.payload = payload;
+
+  std::vector<uint64_t> words = keyWords(key);
+  words.insert(words.end(), header.dims, header.dims + 4);
+  words.push_back(static_cast<uint64_t>(kind));
+  words.push_back(key.size());
+  header.tag = checksum(
+    reinterpret_cast<const unsigned char*>(words.data()), words.size() * sizeof(uint64_t)
+  );
+  return header;
+}
+
+std::string cachePath(const std::string& dir, const char* name, const CacheHeader& header) {
+  char tag[17];
+  std::snprintf(tag, sizeof(tag), "%016llx", static_cast<unsigned long long>(header.tag));
+  return (boost::filesystem::path(dir) / (std::string(name) + "-" + tag + ".bin")).string();
+}
+
+// whether `bytes` (at least payloadOffset(expected) long) start with the header and key
+//  that `expected` and `key` describe; the tag only names the file, so the key itself is
+//  compared in case two keys' tags collide
+bool matchesCache(const unsigned char* bytes, const CacheHeader& expected, const BitString& key) {
+  CacheHeader header;
+  std::memcpy(&header, bytes, sizeof(CacheHeader));
+  if (
+    std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+    header.version != expected.version || header.kind != expected.kind ||
+    header.tag != expected.tag || header.keyBits != expected.keyBits ||
+    header.payload != expected.payload ||
+    !std::equal(header.dims, header.dims + 4, expected.dims)
+  ) {
+    return false;
+  }
+
+  std::vector<uint64_t> words = keyWords(key);
+  return std::memcmp(
+    bytes + sizeof(CacheHeader), words.data(), words.size() * sizeof(uint64_t)
+  ) == 0;
+}
+
+// whether the `size` bytes are exactly what `expected` describes for `key`, checksum and all
+bool verifyCache(
+  const unsigned char* bytes, size_t size, const CacheHeader& expected, const BitString& key
+) {
+  const size_t offset = payloadOffset(expected);
+  if (size != offset + expected.payload || !matchesCache(bytes, expected, key)) {
+    return false;
+  }
+
+  uint64_t stored;
+  std::memcpy(&stored, bytes + offsetof(CacheHeader, checksum), sizeof(stored));
+  return checksum(bytes + offset, expected.payload) == stored;
+}
+
+// map the file at `path` if it holds exactly what `expected` describes for `key`; the whole
+//  payload is checksummed here, so every page is read in once (which is still far cheaper
+//  than regenerating the matrix)
+std::shared_ptr<const MappedFile> openCache(
+  const std::string& path, const CacheHeader& expected, const BitString& key
+) {
+  std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+  if (!file || !verifyCache(file->data(), file->size(), expected, key)) { return nullptr; }
+  return file;
+}
+
+// write the header, key and payload to `out` (filling in the checksum)
+void writeCache(
+  std::ostream& out, CacheHeader header, const BitString& key, const unsigned char* payload
+) {
+  header.checksum = checksum(payload, header.payload);
+  std::vector<uint64_t> words = keyWords(key);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+  out.write(reinterpret_cast<const char*>(payload), header.payload);
+}
+
+// write to a temporary file first and then move it into place so a reader never sees a
+//  partial file (and concurrent writers just replace each other's identical output); the
+//  cache is only an optimization, so failing to write it (e.g. a read-only directory or a
+//  full disk) just gets reported and the caller carries on with what it has in memory
+void writeCache(
+  const std::string& path, const CacheHeader& header, const BitString& key,
+  const unsigned char* payload
+) {
+  boost::filesystem::path target(path), temp;
+  try {
+    boost::filesystem::create_directories(target.parent_path());
+    temp = boost::filesystem::unique_path(path + ".%%%%%%%%");
+    {
+      std::ofstream out(temp.string(), std::ios::binary);
+      writeCache(out, header, key, payload);
+      if (!out) {
+        throw std::runtime_error("[LPN::writeCache] failed to write " + temp.string());
+      }
+    }
+    boost::filesystem::rename(temp, target);
+  } catch (const std::exception& ex) {
+    boost::system::error_code ignored;
+    if (!temp.empty()) { boost::filesystem::remove(temp, ignored); }
+    std::cerr << "[  warn  ] not caching " << path << ": " << ex.what() << std::endl;
+  }
+}
+
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PRIMAL MATRIX
 ////////////////////////////////////////////////////////////////////////////////
 
-PrimalMatrix::PrimalMatrix(const BitString& key, const PrimalParams& params)
-  : SparseMatrix(params.n, params.k), key(key)
-{
-  PRF<uint32_t> prf(key);
+namespace {
 
-  MULTI_TASK([this, &prf, &params](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      for (size_t j = 0; (*this->points)[i].size() < params.l; j++) {
-        uint32_t point = prf(std::make_pair(i, j), params.k);
-        if (
-          std::find(points->at(i).begin(), points->at(i).end(), point) == points->at(i).end()
-        ) {
-          (*this->points)[i].push_back(point);
+// rows up to this weight are sorted with a fixed network rather than std::sort
+const size_t NETWORK_SIZE = 16;
+
+// rows are built this many at a time, with threads taking the next chunk as they finish
+const size_t PRIMAL_CHUNK = 256;
+
+// batcher's odd-even merge sort as a branchless network, with unused slots holding the
+//  maximum value so they sort to the end
+void sortingNetwork(uint32_t (&v)[NETWORK_SIZE]) {
+  for (size_t p = 1; p < NETWORK_SIZE; p <<= 1) {
+    for (size_t d = p; d >= 1; d >>= 1) {
+      for (size_t j = d % p; j + d < NETWORK_SIZE; j += 2 * d) {
+        for (size_t i = 0; i < std::min(d, NETWORK_SIZE - j - d); i++) {
+          if ((i + j) / (2 * p) != (i + j + d) / (2 * p)) { continue; }
+          uint32_t lo = std::min(v[i + j], v[i + j + d]);
+          uint32_t hi = std::max(v[i + j], v[i + j + d]);
+          v[i + j] = lo;
+          v[i + j + d] = hi;
         }
       }
-      std::sort((*this->points)[i].begin(), (*this->points)[i].end());
     }
-  }, params.n);
+  }
+}
+
+// `row` holds PRF(i, 0), ..., PRF(i, l - 1) and is turned into the first l distinct values
+//  of PRF(i, 0), PRF(i, 1), ... in sorted order; since duplicates end up next to each
+//  other after sorting, only rows with a collision need more prf calls
+void finishRow(const PRF<uint32_t>& prf, size_t i, size_t k, size_t l, uint32_t* row) {
+  if (l <= NETWORK_SIZE) {
+    uint32_t v[NETWORK_SIZE];
+    std::copy(row, row + l, v);
+    std::fill(v + l, v + NETWORK_SIZE, UINT32_MAX);
+    sortingNetwork(v);
+    std::copy(v, v + l, row);
+  } else {
+    std::sort(row, row + l);
+  }
+
+  size_t distinct = std::unique(row, row + l) - row;
+  for (size_t j = l; distinct < l; j++) {
+    uint32_t point = prf(std::make_pair(i, j), k);
+    uint32_t* pos = std::lower_bound(row, row + distinct, point);
+    if (pos != row + distinct && *pos == point) { continue; }
+    std::move_backward(pos, row + distinct, row + distinct + 1);
+    *pos = point;
+    distinct++;
+  }
+}
+
+// write rows [`first`, `first` + `count`) to `out`, drawing every row's first l candidates
+//  in the same batched prf calls
+void primalRows(
+  const PRF<uint32_t>& prf, size_t first, size_t count, size_t k, size_t l, uint32_t* out
+) {
+  const size_t BATCH = 1024;
+  std::pair<uint32_t, uint32_t> inputs[BATCH];
+
+  for (size_t from = 0; from < count * l; from += BATCH) {
+    size_t m = std::min(BATCH, count * l - from);
+    for (size_t idx = from; idx < from + m; idx++) {
+      inputs[idx - from] = std::make_pair(first + idx / l, idx % l);
+    }
+    prf(inputs, m, k, out + from);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    finishRow(prf, first + i, k, l, out + i * l);
+  }
 }
 
-PrimalMatrix PrimalMatrix::sample(const PrimalParams& params) {
-  return PrimalMatrix(BitString::sample(LAMBDA), params);
+// row i holds the first l distinct values of PRF(i, 0), PRF(i, 1), ... reduced mod k
+SparseMatrix::RowGenerator primalRows(const BitString& key, const PrimalParams& params) {
+  auto prf = std::make_shared<const PRF<uint32_t>>(key);
+  const size_t k = params.k, l = params.l;
+
+  return [prf, k, l](size_t i, uint32_t* row) { primalRows(*prf, i, 1, k, l, row); };
+}
+
+}
+
+// the storage is left uninitialized so each page is first touched by the thread filling
+//  it, rather than all landing on the allocating thread's numa node
+PrimalMatrix::PrimalMatrix(const BitString& key, const PrimalParams& params, bool implicit)
+  : SparseMatrix(params.n, params.k, params.l, primalRows(key, params)), key(key)
+{
+  if (implicit) { return; }
+
+  const PRF<uint32_t> prf(key);
+  std::shared_ptr<uint32_t[]> points(new uint32_t[params.n * params.l]);
+  const size_t nchunks = (params.n + PRIMAL_CHUNK - 1) / PRIMAL_CHUNK;
+  std::atomic<size_t> next = 0;
+
+  MULTI_TASK([&](size_t, size_t) {
+    for (size_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < nchunks;) {
+      size_t first = c * PRIMAL_CHUNK, count = std::min(PRIMAL_CHUNK, params.n - first);
+      primalRows(prf, first, count, params.k, params.l, points.get() + first * params.l);
+    }
+  }, THREAD_COUNT);
+
+  this->points = std::shared_ptr<const uint32_t>(points, points.get());
+}
+
+PrimalMatrix PrimalMatrix::sample(const PrimalParams& params, bool implicit) {
+  return PrimalMatrix(BitString::sample(LAMBDA), params, implicit);
+}
+
+// the points are used straight out of the mapped file rather than copied into memory
+PrimalMatrix PrimalMatrix::cached(
+  const std::string& dir, const BitString& key, const PrimalParams& params
+) {
+  CacheHeader header = cacheHeader(
+    CacheKind::PRIMAL, key, { params.n, params.k, params.t, params.l },
+    params.n * params.l * sizeof(uint32_t)
+  );
+  const std::string path = cachePath(dir, "primal", header);
+
+  std::shared_ptr<const MappedFile> file = openCache(path, header, key);
+  if (!file) {
+    PrimalMatrix matrix(key, params);
+    writeCache(path, header, key, reinterpret_cast<const unsigned char*>(matrix.points.get()));
+    return matrix;
+  }
+
+  PrimalMatrix matrix(key, params, true);
+  matrix.points = std::shared_ptr<const uint32_t>(
+    file, reinterpret_cast<const uint32_t*>(file->data() + payloadOffset(header))
+  );
+  return matrix;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -152,7 +617,7 @@ PrimalMatrix PrimalMatrix::sample(const PrimalParams& params) {
 ////////////////////////////////////////////////////////////////////////////////
 
 DualMatrix::DualMatrix(const BitString& key, const DualParams& params)
-  : DenseMatrix(params.n, params.N()), key(key)
+  : DenseMatrix(params.n, params.N()), key(key), transposed(std::make_shared<Transposed>())
 {
   PRF<BitString> prf(key);
 
@@ -167,6 +632,186 @@ DualMatrix DualMatrix::sample(const DualParams& params) {
   return DualMatrix(BitString::sample(LAMBDA), params);
 }
 
+// rows are copied out of the mapped file since each bitstring owns its words
+DualMatrix DualMatrix::cached(
+  const std::string& dir, const BitString& key, const DualParams& params
+) {
+  const size_t height = params.n, width = params.N(), stride = (width + 63) / 64;
+  CacheHeader header = cacheHeader(
+    CacheKind::DUAL, key, { height, width, params.t }, height * stride * sizeof(uint64_t)
+  );
+  const std::string path = cachePath(dir, "dual", header);
+
+  std::shared_ptr<const MappedFile> file = openCache(path, header, key);
+  if (!file) {
+    DualMatrix matrix(key, params);
+
+    // bits past the end of each row are cleared so the file only depends on the matrix
+    std::vector<uint64_t> payload(height * stride);
+    const uint64_t lastMask = (width % 64 == 0) ? ~0ull : (1ull << (width % 64)) - 1;
+    MULTI_TASK([&](size_t start, size_t end) {
+      for (size_t i = start; i < end; i++) {
+        uint64_t* row = payload.data() + i * stride;
+        std::memcpy(row, (*matrix.rows)[i].data(), stride * sizeof(uint64_t));
+        row[stride - 1] &= lastMask;
+      }
+    }, height);
+    writeCache(path, header, key, reinterpret_cast<const unsigned char*>(payload.data()));
+    return matrix;
+  }
+
+  DualMatrix matrix;
+  matrix.key = key;
+  matrix.width = width;
+  matrix.rows = std::make_shared<std::vector<BitString>>(height);
+  const unsigned char* rows = file->data() + payloadOffset(header);
+  MULTI_TASK([&](size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) {
+      BitString row(width);
+      std::memcpy(row.data(), rows + i * stride * sizeof(uint64_t), stride * sizeof(uint64_t));
+      (*matrix.rows)[i] = std::move(row);
+    }
+  }, height);
+
+  return matrix;
+}
+
+const std::vector<BitString>& DualMatrix::columns() const {
+  std::call_once(this->transposed->once, [this]() {
+    this->transposed->columns = transpose(*this->rows, this->width);
+  });
+  return this->transposed->columns;
+}
+
+// the t columns picked out for the dual error fall in at most t strips, so gathering those
+//  strips into one k × 64t matrix and transposing it costs O(t·k) rather than the O(k·N)
+//  of transposing the whole matrix
+BitString DualMatrix::sumColumns(const std::vector<size_t>& cols) const {
+  std::vector<size_t> strips;
+  for (size_t c : cols) {
+    if (c >= this->width) {
+      throw std::domain_error("[DualMatrix::sumColumns] column out of range");
+    }
+    strips.push_back(c / 64);
+  }
+  std::sort(strips.begin(), strips.end());
+  strips.erase(std::unique(strips.begin(), strips.end()), strips.end());
+
+  std::vector<BitString> gathered(this->rows->size(), BitString(64 * strips.size()));
+  for (size_t i = 0; i < gathered.size(); i++) {
+    const uint64_t* row = words((*this->rows)[i]);
+    uint64_t* out = words(gathered[i]);
+    for (size_t s = 0; s < strips.size(); s++) { out[s] = row[strips[s]]; }
+  }
+  std::vector<BitString> columns = transpose(gathered, 64 * strips.size());
+
+  BitString out(this->rows->size());
+  for (size_t c : cols) {
+    size_t s = std::lower_bound(strips.begin(), strips.end(), c / 64) - strips.begin();
+    out ^= columns[64 * s + c % 64];
+  }
+  return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// QUASI-CYCLIC MATRIX
+////////////////////////////////////////////////////////////////////////////////
+
+// row i of block j has h_j[(m - i) mod n] in column m, where h_j is the block's first row
+QuasiCyclicMatrix::QuasiCyclicMatrix(const BitString& key, const DualParams& params)
+  : height(params.n), width(params.N()), key(key)
+{
+  PRF<BitString> prf(key);
+  const size_t nblocks = (this->width + this->height - 1) / this->height;
+  this->blocks = std::make_shared<std::vector<BitString>>(nblocks);
+  for (size_t j = 0; j < nblocks; j++) {
+    BitString first = prf(j, this->height);
+    (*this->blocks)[j] = first + first;
+  }
+}
+
+QuasiCyclicMatrix QuasiCyclicMatrix::sample(const DualParams& params) {
+  return QuasiCyclicMatrix(BitString::sample(LAMBDA), params);
+}
+
+bool QuasiCyclicMatrix::operator[](std::pair<size_t, size_t> idx) const {
+  if (idx.first >= this->height || idx.second >= this->width) {
+    throw std::domain_error("[QuasiCyclicMatrix::operator[](std::pair)] idx out of range");
+  }
+  size_t j = idx.second / this->height, m = idx.second % this->height;
+  return (*this->blocks)[j][this->height - idx.first + m];
+}
+
+BitString QuasiCyclicMatrix::operator[](size_t idx) const {
+  if (idx >= this->height) {
+    throw std::domain_error("[QuasiCyclicMatrix::operator[](size_t)] idx out of range");
+  }
+
+  BitString row;
+  row.reserve(this->blocks->size() * this->height);
+  for (const BitString& block : *this->blocks) {
+    row += block[{this->height - idx, 2 * this->height - idx}];
+  }
+  row.resize(this->width);
+  return row;
+}
+
+std::pair<size_t, size_t> QuasiCyclicMatrix::dim() const {
+  return std::make_pair(this->height, this->width);
+}
+
+// block j of row i is the slice of the doubled first row starting at n - i, so both of
+//  these work on those slices in place rather than building whole rows
+BitString QuasiCyclicMatrix::operator*(const BitString& other) const {
+  if (this->width != other.size()) {
+    throw std::domain_error(
+      "[QuasiCyclicMatrix::operator*(BitString)] vector dimension mismatched"
+    );
+  }
+  return TASK_REDUCE<BitString>([this, &other](size_t start, size_t end) {
+    BitString out(end - start);
+    for (size_t i = start; i < end; i++) {
+      bool bit = false;
+      for (size_t j = 0, from = 0; from < this->width; j++, from += this->height) {
+        size_t len = std::min(this->height, this->width - from);
+        size_t shift = this->height - i;
+        bit ^= BitStringView((*this->blocks)[j], shift, len) * other.view(from, from + len);
+      }
+      out[i - start] = bit;
+    }
+    return out;
+  }, BitString::concat, this->height);
+}
+
+void QuasiCyclicMatrix::xorRow(size_t idx, BitString& acc) const {
+  if (idx >= this->height || acc.size() != this->width) {
+    throw std::domain_error("[QuasiCyclicMatrix::xorRow] idx or accumulator out of range");
+  }
+
+  uint64_t* out = words(acc);
+  const size_t nwords = (this->width + 63) / 64;
+  for (size_t j = 0, from = 0; from < this->width; j++, from += this->height) {
+    size_t len = std::min(this->height, this->width - from);
+    BitStringView slice((*this->blocks)[j], this->height - idx, len);
+
+    // each aligned word of the slice lands across at most two words of the row
+    const size_t first = from / 64, shift = from % 64;
+    for (size_t w = 0; w < slice.nWords(); w++) {
+      uint64_t word = slice.word(w);
+      out[first + w] ^= word << shift;
+      if (shift != 0 && first + w + 1 < nwords) { out[first + w + 1] ^= word >> (64 - shift); }
+    }
+  }
+}
+
+std::string QuasiCyclicMatrix::toString() const {
+  std::string out;
+  for (size_t i = 0; i < this->height; i++) {
+    out += this->operator[](i).toString() + "\n";
+  }
+  return out;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // MATRIX PRODUCT
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,13 +820,109 @@ BitString MatrixProduct::operator[](size_t idx) const {
   if (idx >= this->dim().first) {
     throw std::domain_error("[MatrixProduct::operator[](size_t)] idx out of range");
   }
+  if (idx < this->cachedRows) {
+    const size_t stride = (this->dim().second + 63) / 64;
+    BitString row(this->dim().second);
+    std::memcpy(row.data(), this->cache.get() + idx * stride, stride * sizeof(uint64_t));
+    return row;
+  }
+  return this->compute(idx);
+}
 
+BitString MatrixProduct::compute(size_t idx) const {
   BitString row(this->dim().second);
-
   for (uint32_t point : sparse.getNonZeroElements(idx)) {
-    row ^= dense[point];
+    dense->xorRow(point, row);
   }
   return row;
 }
 
+namespace {
+
+// header for `rows` materialized rows of `product` saved under `key`
+CacheHeader productHeader(const MatrixProduct& product, size_t rows, const BitString& key) {
+  const size_t stride = (product.dim().second + 63) / 64;
+  return cacheHeader(
+    CacheKind::PRODUCT, key, { rows, product.dim().second, product.dim().first },
+    rows * stride * sizeof(uint64_t)
+  );
+}
+
+}
+
+// bits past the end of each row are cleared so saved rows only depend on the product
+void MatrixProduct::materialize(size_t rows) {
+  rows = std::min(rows, this->dim().first);
+  const size_t width = this->dim().second, stride = (width + 63) / 64;
+  const uint64_t lastMask = (width % 64 == 0) ? ~0ull : (1ull << (width % 64)) - 1;
+
+  auto cache = std::make_shared<std::vector<uint64_t>>(rows * stride);
+  MULTI_TASK([this, &cache, stride, lastMask](size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) {
+      BitString row = this->compute(i);
+      uint64_t* out = cache->data() + i * stride;
+      std::memcpy(out, row.data(), stride * sizeof(uint64_t));
+      if (stride > 0) { out[stride - 1] &= lastMask; }
+    }
+  }, rows);
+
+  this->cache = std::shared_ptr<const uint64_t>(cache, cache->data());
+  this->cachedRows = rows;
+}
+
+void MatrixProduct::materialize(size_t rows, const std::string& dir, const BitString& key) {
+  rows = std::min(rows, this->dim().first);
+  CacheHeader header = productHeader(*this, rows, key);
+  const std::string path = cachePath(dir, "product", header);
+
+  std::shared_ptr<const MappedFile> file = openCache(path, header, key);
+  if (!file) {
+    this->materialize(rows);
+    writeCache(path, header, key, reinterpret_cast<const unsigned char*>(this->cache.get()));
+    return;
+  }
+
+  this->cache = std::shared_ptr<const uint64_t>(
+    file, reinterpret_cast<const uint64_t*>(file->data() + payloadOffset(header))
+  );
+  this->cachedRows = rows;
+}
+
+void MatrixProduct::save(std::ostream& out, const BitString& key) const {
+  CacheHeader header = productHeader(*this, this->cachedRows, key);
+  writeCache(out, header, key, reinterpret_cast<const unsigned char*>(this->cache.get()));
+  if (!out) { throw std::runtime_error("[MatrixProduct::save] failed to write rows"); }
+}
+
+void MatrixProduct::load(std::istream& in, const BitString& key) {
+  CacheHeader found;
+  in.read(reinterpret_cast<char*>(&found), sizeof(found));
+  if (!in) { throw std::runtime_error("[MatrixProduct::load] failed to read header"); }
+
+  // the rest is only read once the sizes check out, so a bad file can't force a huge
+  //  allocation
+  CacheHeader expected = productHeader(*this, std::min(found.dims[0], this->dim().first), key);
+  if (
+    found.dims[0] > this->dim().first || found.keyBits != expected.keyBits ||
+    found.payload != expected.payload
+  ) {
+    throw std::domain_error("[MatrixProduct::load] saved rows do not match this product");
+  }
+
+  const size_t offset = payloadOffset(expected), size = offset + expected.payload;
+  auto bytes = std::make_shared<std::vector<uint64_t>>(size / sizeof(uint64_t));
+  unsigned char* raw = reinterpret_cast<unsigned char*>(bytes->data());
+  std::memcpy(raw, &found, sizeof(found));
+  in.read(reinterpret_cast<char*>(raw + sizeof(found)), size - sizeof(found));
+  if (!in) { throw std::runtime_error("[MatrixProduct::load] failed to read rows"); }
+
+  if (!verifyCache(raw, size, expected, key)) {
+    throw std::domain_error("[MatrixProduct::load] saved rows do not match this product");
+  }
+  this->cache = std::shared_ptr<const uint64_t>(
+    bytes, bytes->data() + offset / sizeof(uint64_t)
+  );
+  this->cachedRows = expected.dims[0];
+}
+
 }
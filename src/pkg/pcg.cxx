@@ -17,17 +17,71 @@ namespace PCG {
 // PCG PROTOCOL METHODS
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// pins down both public matrices for the product cache: the seeds along with every
+//  parameter the matrix dimensions don't already cover
+BitString productKey(const PCGParams& params) {
+  return params.pkey + params.dkey
+    + BitString::fromUInt(params.primal.k) + BitString::fromUInt(params.primal.l)
+    + BitString::fromUInt(params.primal.t) + BitString::fromUInt(params.dual.t)
+    + BitString::fromUInt(static_cast<uint32_t>(params.dualCode));
+}
+
+// zeroed columns of the (ε ⊗ s) matrix for the pprf leafs to be written into
+std::vector<BitString> columns(const PCGParams& params) {
+  std::vector<BitString> matrix(params.primal.k);
+  MULTI_TASK([&](size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) { matrix[i] = BitString(params.dual.N()); }
+  }, params.primal.k);
+  return matrix;
+}
+
+}
+
+// the implicit primal matrix and the quasi-cyclic dual matrix are cheap enough to make that
+//  they are never cached
 void Base::init() {
-  this->A = LPN::PrimalMatrix(params.pkey, params.primal);
-  this->H = LPN::DualMatrix(params.dkey, params.dual);
+  const bool cache = !params.cacheDir.empty();
+
+  if (cache && !params.implicitPrimal) {
+    this->A = LPN::PrimalMatrix::cached(params.cacheDir, params.pkey, params.primal);
+  } else {
+    this->A = LPN::PrimalMatrix(params.pkey, params.primal, params.implicitPrimal);
+  }
+
+  if (params.dualCode == DualCode::QUASI_CYCLIC) {
+    this->H = std::make_shared<LPN::QuasiCyclicMatrix>(params.dkey, params.dual);
+  } else if (cache) {
+    this->H = std::make_shared<LPN::DualMatrix>(
+      LPN::DualMatrix::cached(params.cacheDir, params.dkey, params.dual)
+    );
+  } else {
+    this->H = std::make_shared<LPN::DualMatrix>(params.dkey, params.dual);
+  }
   this->B = LPN::MatrixProduct(A, H);
 }
 
+// only done once the rows of B are actually needed, so nothing holds them through the
+//  protocol (and init() being called again after clear() doesn't compute them twice)
+void Base::materializeProduct() {
+  if (!params.materializeProduct || this->B.materialized() > 0) { return; }
+
+  if (!params.cacheDir.empty()) {
+    this->B.materialize(params.size, params.cacheDir, productKey(params));
+  } else {
+    this->B.materialize(params.size);
+  }
+}
+
 void Sender::prepare() {
 
-  // initialize the pprfs that we are sending
+  // initialize the pprfs that we are sending, with their leafs going straight into our
+  //  shares of the (ε ⊗ s) matrix columns
+  this->eXs_matrix = columns(params);
   this->eXs = PPRF::sample(
-    params.dual.t, LAMBDA, params.primal.k, params.dual.blockSize()
+    params.dual.t, LAMBDA, params.primal.k, params.dual.blockSize(),
+    transposeSink(this->eXs_matrix, params)
   );
   this->eXas_eoe = BitPPRF::sample(params.primal.t, LAMBDA, params.primal.blockSize());
 
@@ -55,15 +109,12 @@ void Receiver::prepare() {
   // sample dual error vector
   this->epsilon = sampleVector(params.dual.t, params.dual.blockSize());
 
-  // compute secret vector based on the dual matrix H and error ε
-  this->s = BitString(params.primal.k);
-  for (size_t i = 0; i < params.primal.k; i++) {
-    for (size_t j = 0 ; j < params.dual.t; j++) {
-      if (this->H[{i, j * params.dual.blockSize() + this->epsilon[j]}]) {
-        this->s[i] ^= 1;
-      }
-    }
+  // compute secret vector s = H · ε, which is just the sum of the columns ε picks out
+  std::vector<size_t> cols(params.dual.t);
+  for (size_t j = 0; j < params.dual.t; j++) {
+    cols[j] = j * params.dual.blockSize() + this->epsilon[j];
   }
+  this->s = this->H->sumColumns(cols);
 
   // encrypt secret vector
   this->enc_s = this->ahe.encrypt(this->s);
@@ -142,18 +193,15 @@ void Receiver::online(Channel channel, ROT::Sender srots, ROT::Receiver rrots) {
 
 void Sender::finalize() {
 
-  // arrange our shares of the (ε ⊗ s) matrix by column
-  this->eXs_matrix = transpose(this->eXs, params);
+  // our shares of the (ε ⊗ s) matrix were filled in as the pprfs were made
+  for (PPRF& pprf : this->eXs) { pprf.clear(); }
 
   // expand the pprf that was received
-  MULTI_TASK([this](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      this->eXas[i].expand();
-    }
-  }, params.primal.t);
+  BitPPRF::expand(this->eXas);
 
   // concatenate the image for each error block to get final output
   this->output.clear();
+  this->output.reserve(params.primal.n);
   for (size_t i = 0; i < params.primal.t; i++) {
     BitString image = this->eXas_eoe[i].image() ^ this->eXas[i].image();
 
@@ -171,25 +219,18 @@ void Sender::finalize() {
 
 void Receiver::finalize() {
 
-  // expand the (ε ⊗ s) pprf
-  MULTI_TASK([this](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      this->eXs[i].expand();
-    }
-  }, this->eXs.size());
-
-  // arrange our shares of the (ε ⊗ s) matrix by column
-  this->eXs_matrix = transpose(this->eXs, params);
+  // expand the (ε ⊗ s) pprf straight into our shares of its columns, so the leafs are
+  //  never all held at once
+  this->eXs_matrix = columns(params);
+  PPRF::expand(this->eXs, transposeSink(this->eXs_matrix, params));
+  for (PPRF& pprf : this->eXs) { pprf.clear(); }
 
   // expand the (⟨aᵢ,s₀⟩ · e₁) ⊕ (e₀ ○ e₁) pprf
-  MULTI_TASK([this](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      this->eXas_eoe[i].expand();
-    }
-  }, params.primal.t);
+  BitPPRF::expand(this->eXas_eoe);
 
   // in each direction, concatenate the image for each error block to get final output
   this->output.clear();
+  this->output.reserve(params.primal.n);
   for (size_t i = 0; i < params.blocks(); i++) {
     BitString image = this->eXas_eoe[i].image() ^ this->eXas[i].image();
 
@@ -206,8 +247,20 @@ void Receiver::finalize() {
 }
 
 void Base::expand() {
-  // compute shares of the ⟨bᵢ⊗ aᵢ,ε ⊗ s⟩ vector
-  auto baex = TASK_REDUCE<BitString>([this](size_t start, size_t end) {
+  bool gram = this->params.expansion == Expansion::GRAM;
+  if (this->params.expansion == Expansion::AUTO) {
+    // the gram matrix costs k² inner products up front, while the direct approach
+    //  costs about (2l + 1) row operations for each output
+    size_t k = this->params.primal.k;
+    gram = k * k < this->params.size * (2 * this->params.primal.l + 1);
+  }
+
+  if (!gram) { this->materializeProduct(); }
+  this->output ^= gram ? this->expandGram() : this->expandDirect();
+}
+
+BitString Base::expandDirect() const {
+  return TASK_REDUCE<BitString>([this](size_t start, size_t end) {
     BitString out(end - start);
     for (size_t i = start; i < end; i++) {
       BitString aXeXs(params.dual.N());
@@ -217,15 +270,28 @@ void Base::expand() {
       out[i - start] = this->B[i] * aXeXs;
     }
     return out;
-  }, [](std::vector<BitString> results) {
-    BitString out;
-    for (const BitString& result : results) {
-      out += result;
+  }, BitString::concat, params.size);
+}
+
+// since ⟨bᵢ⊗ aᵢ,ε ⊗ s⟩ = Σ ⟨H[a],(ε ⊗ s)[b]⟩ over all a,b ∈ aᵢ we can precompute
+//  every ⟨H[a],(ε ⊗ s)[b]⟩ and then each output is just l² lookups
+BitString Base::expandGram() const {
+  LPN::DenseMatrix G = this->H->gram(this->eXs_matrix);
+
+  return TASK_REDUCE<BitString>([this, &G](size_t start, size_t end) {
+    BitString out(end - start);
+    for (size_t i = start; i < end; i++) {
+      std::span<const uint32_t> points = this->A.getNonZeroElements(i);
+      bool bit = false;
+      for (uint32_t a : points) {
+        for (uint32_t b : points) {
+          bit ^= G[{a, b}];
+        }
+      }
+      out[i - start] = bit;
     }
     return out;
-  }, params.size);
-
-  this->output ^= baex;
+  }, BitString::concat, params.size);
 }
 
 std::vector<AHE::Ciphertext> Base::homomorphicInnerProduct(
@@ -236,7 +302,7 @@ std::vector<AHE::Ciphertext> Base::homomorphicInnerProduct(
     uint32_t idx = (i * this->params.primal.blockSize()) + this->e[i];
 
     // homomorphically compute the inner product of aᵢand Enc(s)
-    std::vector<uint32_t> points = this->A.getNonZeroElements(idx);
+    std::span<const uint32_t> points = this->A.getNonZeroElements(idx);
     AHE::Ciphertext ctx = enc_s[points[0]];
     for (size_t i = 1; i < points.size(); i++) {
       ctx = this->ahe.add(ctx, enc_s[points[i]]);
@@ -288,7 +354,8 @@ BitString Base::inputs() const {
   for (size_t i = 0; i < params.primal.t; i++) {
     out[(i * params.primal.blockSize()) + this->e[i]] ^= 1;
   }
-  return out[{0, params.size}];
+  out.resize(params.size);
+  return out;
 }
 
 }
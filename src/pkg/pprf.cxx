@@ -1,127 +1,414 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <stack>
 
-#include "cryptoTools/Crypto/PRNG.h"
+#include "cryptoTools/Crypto/AES.h"
 
 #include "pkg/pprf.hpp"
 #include "ahe/ahe.hpp"
 #include "util/concurrency.hpp"
 
+////////////////////////////////////////////////////////////////////////////////
+// GGM TREE PRG
+////////////////////////////////////////////////////////////////////////////////
 
-PPRF::PPRF(BitString key, size_t outsize, size_t domainsize)
-  : keysize(key.size()), domainsize(domainsize), outsize(outsize),
-    depth((size_t) ceil(log2(domainsize)))
-{
-  std::vector<BitString> seed({key});
-  this->leafs = std::make_shared<std::vector<BitString>>(seed);
-  this->levels.resize(depth + 1);
+namespace {
+
+// fixed-key aes permutations: two for the halves of the length-doubling prg and one more
+//  for stretching seeds into leaf outputs
+const AES LEFT(toBlock(0x243f6a8885a308d3ull, 0x13198a2e03707344ull));
+const AES RIGHT(toBlock(0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull));
+const AES LEAF(toBlock(0x452821e638d01377ull, 0xbe5466cf34e90c6cull));
+
+// number of nodes expanded together so the aes-ni pipeline stays full
+const size_t GGM_BATCH = 8;
+
+// tree nodes are single blocks so keys can be at most this many bits
+const size_t MAX_NODE_BITS = 128;
+
+// mask for the low `bits` bits of a block
+block nodeMask(size_t bits) {
+  if (bits >= 128) { return toBlock(~0ull, ~0ull); }
+  if (bits >= 64)  { return toBlock(bits == 64 ? 0 : (1ull << (bits - 64)) - 1, ~0ull); }
+  return toBlock(0, (1ull << bits) - 1);
+}
+
+block toNode(const BitString& bs) {
+  block b = toBlock(0, 0);
+  std::memcpy(&b, bs.data(), std::min(bs.nBytes(), sizeof(block)));
+  return b & nodeMask(bs.size());
+}
+
+BitString fromNode(block b, size_t bits) {
+  return BitString(reinterpret_cast<unsigned char*>(&b), bits);
+}
 
-  // expand the tree but only hold onto the last level evaluated
-  for (size_t l = 0; l < depth; l++) {
-    auto next = std::make_shared<std::vector<BitString>>(this->leafs->size() * 2);
+bool lowBit(const block& b) {
+  unsigned char byte;
+  std::memcpy(&byte, &b, 1);
+  return byte & 1;
+}
+
+// σ(x) = (x_hi ⊕ x_lo) ‖ x_hi, a linear orthomorphism so that π(σ(x)) ⊕ σ(x) is a
+//  circular correlation-robust hash as needed by the half-tree construction
+block sigma(const block& x) {
+  uint64_t w[2];
+  std::memcpy(w, &x, sizeof(block));
+  return toBlock(w[1] ^ w[0], w[1]);
+}
 
-    BitString left(this->keysize), right(this->keysize);
-    for (size_t i = 0; i < this->leafs->size(); i++) {
-      PRNG prng(toBlock((*this->leafs)[i].data()));
-      (*next)[2 * i].resize(this->keysize);
-      (*next)[2 * i + 1].resize(this->keysize);
-      prng.get<uint8_t>((*next)[2 * i].data(), (this->keysize + 7) / 8);
-      prng.get<uint8_t>((*next)[2 * i + 1].data(), (this->keysize + 7) / 8);
+// cache-line aligned storage for every node of a tree's widest level
+using NodeBuffer = std::unique_ptr<block[], decltype(&std::free)>;
+
+NodeBuffer allocateNodes(size_t n) {
+  size_t bytes = ((n * sizeof(block) + 63) / 64) * 64;
+  block* nodes = static_cast<block*>(std::aligned_alloc(64, bytes));
+  if (nodes == nullptr) { throw std::bad_alloc(); }
+  return NodeBuffer(nodes, &std::free);
+}
+
+// several trees of the same shape can be expanded together by interleaving them, so that
+//  node i of tree t lives at nodes[i * trees + t] and each aes batch spans all trees
+
+// most trees interleaved at once, which already keeps the aes pipeline full while the
+//  node buffer only ever holds this many trees' widest levels
+const size_t INTERLEAVE = 16;
+
+// replace the `n` parents at the front of each tree with their 2n children using
+//  G(s) = (π₀(s) ⊕ s, π₁(s) ⊕ s) where πᵢ is aes under a fixed key (a correlation-robust
+//  hash), or for the half-tree (H(s), H(s) ⊕ s) with H(s) = π₀(σ(s)) ⊕ σ(s) which takes
+//  a single aes call; working from the back means children only ever overwrite expanded
+//  parents
+void expandInPlace(block* nodes, size_t n, size_t trees, const block& mask, TreeMode mode) {
+  // expand enough parents at once to fill the pipeline even for a single tree
+  const size_t groups = std::max<size_t>(1, GGM_BATCH / trees);
+  std::vector<block> parents(groups * trees), left(groups * trees), right(groups * trees);
+
+  for (size_t end = n; end > 0;) {
+    size_t start = end - std::min(groups, end);
+    size_t m = (end - start) * trees;
+    std::copy(nodes + start * trees, nodes + end * trees, parents.begin());
+
+    if (mode == TreeMode::HALFTREE) {
+      for (size_t k = 0; k < m; k++) { right[k] = sigma(parents[k]); }
+      LEFT.ecbEncBlocks(right.data(), m, left.data());
+      for (size_t k = 0; k < m; k++) {
+        left[k] ^= right[k];
+        right[k] = left[k] ^ parents[k];
+      }
+    } else {
+      LEFT.ecbEncBlocks(parents.data(), m, left.data());
+      RIGHT.ecbEncBlocks(parents.data(), m, right.data());
+      for (size_t k = 0; k < m; k++) {
+        left[k] ^= parents[k];
+        right[k] ^= parents[k];
+      }
+    }
 
-      left ^= (*next)[2 * i];
-      right ^= (*next)[2 * i + 1];
+    for (size_t i = start; i < end; i++) {
+      for (size_t t = 0, k = (i - start) * trees; t < trees; t++, k++) {
+        nodes[(2 * i) * trees + t]     = left[k] & mask;
+        nodes[(2 * i + 1) * trees + t] = right[k] & mask;
+      }
     }
+    end = start;
+  }
+}
 
-    // save the left and right xors
-    this->levels[l] = std::make_pair(left, right);
-    this->leafs = next;
+// xor of all the left (even) and all the right (odd) nodes among the first `n` of each tree
+void sideSums(const block* nodes, size_t n, size_t trees, block* left, block* right) {
+  std::fill(left, left + trees, toBlock(0, 0));
+  std::fill(right, right + trees, toBlock(0, 0));
+  for (size_t i = 0; i < n; i += 2) {
+    for (size_t t = 0; t < trees; t++) {
+      left[t] ^= nodes[i * trees + t];
+      right[t] ^= nodes[(i + 1) * trees + t];
+    }
   }
+}
 
-  BitString left(this->outsize), right(this->outsize);
-  for (size_t i = 0; i < this->leafs->size(); i++) {
-    if (i >= this->domainsize) {
-      // if domainsize isn't (2^x) toss out the extra leafs
-      (*this->leafs)[i] = BitString();
-    } else {
-      PRNG prng(toBlock((*this->leafs)[i].data()));
-      (*this->leafs)[i].resize(this->outsize);
-      prng.get<uint8_t>((*this->leafs)[i].data(), (this->outsize + 7) / 8);
+// stretch each of the `n` seeds (every `stride`th block) to `bits` bits where block j is
+//  π₂(s ⊕ j) ⊕ s ⊕ j
+void leafOutputs(const block* seeds, size_t stride, size_t n, size_t bits, BitString* out) {
+  const size_t blocks = (bits + 127) / 128;
+  std::vector<block> in(GGM_BATCH * blocks), enc(GGM_BATCH * blocks);
+  for (size_t i = 0; i < n; i += GGM_BATCH) {
+    size_t m = std::min(GGM_BATCH, n - i);
+    for (size_t k = 0; k < m; k++) {
+      for (size_t j = 0; j < blocks; j++) {
+        in[k * blocks + j] = seeds[(i + k) * stride] ^ toBlock(0, j);
+      }
+    }
+    LEAF.ecbEncBlocks(in.data(), m * blocks, enc.data());
+    for (size_t k = 0; k < m * blocks; k++) { enc[k] ^= in[k]; }
+    for (size_t k = 0; k < m; k++) {
+      out[i + k] = BitString(reinterpret_cast<unsigned char*>(&enc[k * blocks]), bits);
+    }
+  }
+}
 
-      if (i % 2 == 0) { left ^= (*this->leafs)[i]; }
-      else            { right ^= (*this->leafs)[i]; }
+// as leafOutputs but packed one after another in ⌈bits / 8⌉ bytes each
+void leafBytes(const block* seeds, size_t stride, size_t n, size_t bits, uint8_t* out) {
+  const size_t blocks = (bits + 127) / 128, bytes = (bits + 7) / 8;
+  std::vector<block> in(GGM_BATCH * blocks), enc(GGM_BATCH * blocks);
+  for (size_t i = 0; i < n; i += GGM_BATCH) {
+    size_t m = std::min(GGM_BATCH, n - i);
+    for (size_t k = 0; k < m; k++) {
+      for (size_t j = 0; j < blocks; j++) {
+        in[k * blocks + j] = seeds[(i + k) * stride] ^ toBlock(0, j);
+      }
+    }
+    LEAF.ecbEncBlocks(in.data(), m * blocks, enc.data());
+    for (size_t k = 0; k < m * blocks; k++) { enc[k] ^= in[k]; }
+    for (size_t k = 0; k < m; k++) {
+      std::memcpy(out + (i + k) * bytes, &enc[k * blocks], bytes);
     }
   }
+}
+
+// number of leafs handed to a sink at once, small enough to stay in cache
+const size_t LEAF_CHUNK = 512;
 
-  this->levels[this->depth] = std::make_pair(left, right);
+// hand the `domainsize` leafs grown from `seeds` (every `stride`th block) to `sink` as tree
+//  `tree` a chunk at a time with the leaf at `skip` (if any) zeroed, returning the xors of
+//  the even and the odd leafs
+std::pair<BitString, BitString> streamLeafs(
+  const block* seeds, size_t stride, size_t domainsize, size_t outsize, size_t skip,
+  const PPRF::LeafSink& sink, size_t tree
+) {
+  const size_t bytes = (outsize + 7) / 8;
+  std::vector<uint8_t> chunk(LEAF_CHUNK * bytes);
+  std::vector<uint8_t> sums(2 * bytes);
+
+  for (size_t offset = 0; offset < domainsize; offset += LEAF_CHUNK) {
+    size_t m = std::min(LEAF_CHUNK, domainsize - offset);
+    leafBytes(seeds + offset * stride, stride, m, outsize, chunk.data());
+    if (skip >= offset && skip < offset + m) {
+      std::fill_n(chunk.data() + (skip - offset) * bytes, bytes, 0);
+    }
+
+    for (size_t i = 0; i < m; i++) {
+      uint8_t* sum = sums.data() + ((offset + i) % 2) * bytes;
+      const uint8_t* leaf = chunk.data() + i * bytes;
+      for (size_t j = 0; j < bytes; j++) { sum[j] ^= leaf[j]; }
+    }
+    sink(tree, offset, chunk.data(), m);
+  }
+
+  return std::make_pair(BitString(sums.data(), outsize), BitString(sums.data() + bytes, outsize));
+}
+
+// grow a single tree from `key` in place, saving the xors of the left and the right nodes
+//  of each level into levels[0..depth) and returning the leaf seeds
+NodeBuffer growTree(
+  const BitString& key, size_t depth, TreeMode mode,
+  std::vector<std::pair<BitString, BitString>>& levels
+) {
+  const block mask = nodeMask(key.size());
+  NodeBuffer nodes = allocateNodes(size_t(1) << depth);
+  nodes[0] = toNode(key);
+
+  // expand the tree in place so only the last level evaluated is held onto
+  for (size_t l = 0, width = 1; l < depth; l++, width *= 2) {
+    expandInPlace(nodes.get(), width, 1, mask, mode);
+    block left, right;
+    sideSums(nodes.get(), 2 * width, 1, &left, &right);
+    levels[l] = std::make_pair(fromNode(left, key.size()), fromNode(right, key.size()));
+  }
+  return nodes;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// PPRF
+////////////////////////////////////////////////////////////////////////////////
+
+PPRF::PPRF(const BitString& key, size_t outsize, size_t domainsize, TreeMode mode)
+  : keysize(key.size()), domainsize(domainsize), outsize(outsize),
+    depth((size_t) ceil(log2(domainsize))), mode(mode)
+{
+  if (this->keysize > MAX_NODE_BITS) {
+    throw std::invalid_argument("[PPRF::PPRF] keys can be at most 128 bits");
+  }
+  this->levels.resize(depth + 1);
+  NodeBuffer nodes = growTree(key, depth, mode, this->levels);
+
+  // if domainsize isn't (2^x) the extra leafs are left empty
+  this->leafs = std::make_shared<std::vector<BitString>>(size_t(1) << depth);
+  leafOutputs(nodes.get(), 1, this->domainsize, this->outsize, this->leafs->data());
+
+  BitString left(this->outsize), right(this->outsize);
+  for (size_t i = 0; i < this->domainsize; i++) {
+    if (i % 2 == 0) { left ^= (*this->leafs)[i]; }
+    else            { right ^= (*this->leafs)[i]; }
+  }
+
+  this->levels[this->depth] = std::make_pair(std::move(left), std::move(right));
 
   this->expanded = true;
 }
 
 PPRF::PPRF(
-  std::vector<BitString> keys, uint32_t puncture, size_t outsize, size_t domainsize
-) : keys(keys), keysize(keys[0].size()), domainsize(domainsize), outsize(outsize),
-    depth((size_t) ceil(log2(domainsize))), expanded(false), puncture(puncture) { }
+  const BitString& key, size_t outsize, size_t domainsize, const LeafSink& sink,
+  size_t tree, TreeMode mode
+) : keysize(key.size()), domainsize(domainsize), outsize(outsize),
+    depth((size_t) ceil(log2(domainsize))), mode(mode)
+{
+  if (this->keysize > MAX_NODE_BITS) {
+    throw std::invalid_argument("[PPRF::PPRF] keys can be at most 128 bits");
+  }
+  this->levels.resize(depth + 1);
+  NodeBuffer nodes = growTree(key, depth, mode, this->levels);
+
+  // the leafs go to `sink` as they're made so only their sums are held onto
+  this->levels[this->depth] = streamLeafs(
+    nodes.get(), 1, this->domainsize, this->outsize, this->domainsize, sink, tree
+  );
+
+  this->expanded = false;
+}
+
+PPRF::PPRF(
+  std::vector<BitString> keys, uint32_t puncture, size_t outsize, size_t domainsize,
+  TreeMode mode
+) : keysize(keys[0].size()), domainsize(domainsize), outsize(outsize),
+    depth((size_t) ceil(log2(domainsize))), mode(mode), expanded(false), puncture(puncture)
+{
+  // moved in the body so the initializers above can still read from `keys`
+  this->keys = std::move(keys);
+}
 
 void PPRF::expand() {
-  std::vector<BitString> seed({BitString()});
-  this->leafs = std::make_shared<std::vector<BitString>>(seed);
+  expand(this, 1);
+}
 
-  BitString path = BitString::fromUInt(puncture, depth).reverse();
+void PPRF::expand(std::vector<PPRF>& pprfs) {
+  // give each thread a contiguous range of trees to advance together
+  MULTI_TASK([&pprfs](size_t start, size_t end) {
+    if (start >= end) { return; }
+    expand(pprfs.data() + start, end - start);
+  }, pprfs.size());
+}
 
-  for (size_t l = 0; l < depth; l++) {
-    auto next = std::make_shared<std::vector<BitString>>(this->leafs->size() * 2);
-    size_t sibling;
+void PPRF::expand(std::vector<PPRF>& pprfs, const LeafSink& sink) {
+  MULTI_TASK([&pprfs, &sink](size_t start, size_t end) {
+    if (start >= end) { return; }
+    expand(pprfs.data() + start, end - start, &sink, start);
+  }, pprfs.size());
+}
 
-    BitString left(this->keysize), right(this->keysize);
-    for (size_t i = 0; i < this->leafs->size(); i++) {
-      // if at the puncture point just insert the key for that
-      if ((*this->leafs)[i].size() == 0) {
-        sibling = 2 * i + (path[l] ? 0 : 1);
-      } else {
-        PRNG prng(toBlock((*this->leafs)[i].data()));
-        (*next)[2 * i].resize(this->keysize);
-        (*next)[2 * i + 1].resize(this->keysize);
-        prng.get<uint8_t>((*next)[2 * i].data(), (this->keysize + 7) / 8);
-        prng.get<uint8_t>((*next)[2 * i + 1].data(), (this->keysize + 7) / 8);
-
-        left ^= (*next)[2 * i];
-        right ^= (*next)[2 * i + 1];
-      }
+void PPRF::expand(PPRF* pprfs, size_t n, const LeafSink* sink, size_t first) {
+  if (n == 0) { return; }
+  if (n > INTERLEAVE) {
+    for (size_t i = 0; i < n; i += INTERLEAVE) {
+      expand(pprfs + i, std::min(INTERLEAVE, n - i), sink, first + i);
+    }
+    return;
+  }
+  const size_t keysize = pprfs[0].keysize, depth = pprfs[0].depth;
+  const size_t outsize = pprfs[0].outsize, domainsize = pprfs[0].domainsize;
+  const TreeMode mode = pprfs[0].mode;
+  for (size_t t = 0; t < n; t++) {
+    if (
+      pprfs[t].keysize != keysize || pprfs[t].depth != depth
+      || pprfs[t].outsize != outsize || pprfs[t].domainsize != domainsize
+      || pprfs[t].mode != mode
+    ) {
+      throw std::invalid_argument("[PPRF::expand] pprfs expanded together must match");
     }
-
-    // for inner nodes place the new key in the sibling position
-    (*next)[sibling] = this->keys[l] ^ (path[l] ? left : right);
-    this->leafs = next;
+  }
+  if (keysize > MAX_NODE_BITS) {
+    throw std::invalid_argument("[PPRF::expand] keys can be at most 128 bits");
   }
 
-  BitString left(this->outsize), right(this->outsize);
-  for (size_t i = 0; i < this->leafs->size(); i++) {
-    if ((*this->leafs)[i].size() == 0) { continue; }
-    if (i >= this->domainsize) {
-      // if domainsize isn't (2^x) toss out the extra leafs
-      (*this->leafs)[i] = BitString();
-    } else {
-      PRNG prng(toBlock((*this->leafs)[i].data()));
-      (*this->leafs)[i].resize(this->outsize);
-      prng.get<uint8_t>((*this->leafs)[i].data(), (this->outsize + 7) / 8);
+  const block mask = nodeMask(keysize);
+  NodeBuffer nodes = allocateNodes((size_t(1) << depth) * n);
+  std::fill(nodes.get(), nodes.get() + n, toBlock(0, 0));
+  std::vector<block> left(n), right(n);
+
+  for (size_t l = 0, width = 1; l < depth; l++, width *= 2) {
+    expandInPlace(nodes.get(), width, n, mask, mode);
+    sideSums(nodes.get(), 2 * width, n, left.data(), right.data());
+
+    for (size_t t = 0; t < n; t++) {
+      // the punctured node on this level and which of its children is on the path
+      size_t punctured = pprfs[t].puncture >> (depth - l);
+      bool bit = (pprfs[t].puncture >> (depth - l - 1)) & 1;
+      block& on = nodes[(2 * punctured + bit) * n + t];
+      block& sibling = nodes[(2 * punctured + !bit) * n + t];
+
+      // the punctured node expands to junk, so cancel its children out of the sums
+      left[t] ^= nodes[(2 * punctured) * n + t];
+      right[t] ^= nodes[(2 * punctured + 1) * n + t];
+
+      // for inner nodes place the new key in the sibling position
+      sibling = toNode(pprfs[t].keys[l]) ^ (bit ? left[t] : right[t]);
+      on = toBlock(0, 0);
+    }
+  }
 
-      if (i % 2 == 0) { left ^= (*this->leafs)[i]; }
-      else            { right ^= (*this->leafs)[i]; }
+  // hand the leafs over a chunk at a time, keeping the sums needed for the punctured leaf
+  if (sink != nullptr) {
+    for (size_t t = 0; t < n; t++) {
+      const PPRF& pprf = pprfs[t];
+      auto [left, right] = streamLeafs(
+        nodes.get() + t, n, domainsize, outsize, pprf.puncture, *sink, first + t
+      );
+
+      // put the punctured output where it should be
+      BitString punctured = pprf.keys[depth] ^ (pprf.puncture % 2 == 0 ? left : right);
+      (*sink)(first + t, pprf.puncture, punctured.data(), 1);
     }
+    return;
   }
 
-  // put the punctured output where it should be
-  (*this->leafs)[puncture] = (
-    this->keys[depth] ^ (puncture % 2 == 0 ? left : right)
-  );
+  for (size_t t = 0; t < n; t++) {
+    PPRF& pprf = pprfs[t];
 
-  this->expanded = true;
+    // if domainsize isn't (2^x) the extra leafs are left empty
+    pprf.leafs = std::make_shared<std::vector<BitString>>(size_t(1) << depth);
+    leafOutputs(nodes.get() + t, n, domainsize, outsize, pprf.leafs->data());
+
+    BitString left(outsize), right(outsize);
+    for (size_t i = 0; i < domainsize; i++) {
+      if (i == pprf.puncture) { continue; }
+      if (i % 2 == 0) { left ^= (*pprf.leafs)[i]; }
+      else            { right ^= (*pprf.leafs)[i]; }
+    }
+
+    // put the punctured output where it should be
+    (*pprf.leafs)[pprf.puncture] = (
+      pprf.keys[depth] ^ (pprf.puncture % 2 == 0 ? left : right)
+    );
+
+    pprf.expanded = true;
+  }
 }
 
-std::vector<PPRF> PPRF::sample(size_t n, size_t keysize, size_t outsize, size_t domainsize) {
+std::vector<PPRF> PPRF::sample(
+  size_t n, size_t keysize, size_t outsize, size_t domainsize, TreeMode mode
+) {
+  std::vector<PPRF> pprfs(n);
+  MULTI_TASK([&pprfs, &keysize, &outsize, &domainsize, &mode](size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) {
+      pprfs[i] = PPRF(BitString::sample(keysize), outsize, domainsize, mode);
+    }
+  }, n);
+  return pprfs;
+}
+
+std::vector<PPRF> PPRF::sample(
+  size_t n, size_t keysize, size_t outsize, size_t domainsize, const LeafSink& sink,
+  TreeMode mode
+) {
   std::vector<PPRF> pprfs(n);
-  MULTI_TASK([&pprfs, &n, &keysize, &outsize, &domainsize](size_t start, size_t end) {
+  MULTI_TASK([&](size_t start, size_t end) {
     for (size_t i = start; i < end; i++) {
-      pprfs[i] = PPRF(BitString::sample(keysize), outsize, domainsize);
+      pprfs[i] = PPRF(BitString::sample(keysize), outsize, domainsize, sink, i, mode);
     }
   }, n);
   return pprfs;
@@ -141,9 +428,11 @@ BitString PPRF::operator()(uint32_t x) const {
 ////////////////////////////////////////////////////////////////////////////////
 
 void PPRF::send(
-  std::vector<PPRF> pprfs, BitString payload, Channel channel, ROT::Sender rots
+  const std::vector<PPRF>& pprfs, const BitString& payload, Channel channel,
+  ROT::Sender rots
 ) {
   std::vector<std::pair<BitString, BitString>> messages;
+  if (!pprfs.empty()) { messages.reserve(pprfs.size() * pprfs[0].levels.size()); }
   for (const PPRF& pprf : pprfs) {
     if (payload.size() != pprf.outsize) {
       throw std::invalid_argument("[PPRF::send()] payload size does not match pprf output size");
@@ -166,8 +455,8 @@ void PPRF::send(
 }
 
 std::vector<PPRF> PPRF::receive(
-  std::vector<uint32_t> points, size_t keysize, size_t outsize, size_t domainsize,
-  Channel channel, ROT::Receiver rots
+  const std::vector<uint32_t>& points, size_t keysize, size_t outsize, size_t domainsize,
+  Channel channel, ROT::Receiver rots, TreeMode mode
 ) {
   size_t depth = (size_t) ceil(log2(domainsize));
   BitString choices;
@@ -191,148 +480,270 @@ std::vector<PPRF> PPRF::receive(
   std::vector<BitString> allkeys = rots.transfer(choices, sizes, channel);
 
   std::vector<PPRF> pprfs;
+  pprfs.reserve(points.size());
   for (size_t i = 0; i < points.size(); i++) {
     std::vector<BitString> keys(
-      allkeys.begin() + i * (depth + 1),
-      allkeys.begin() + (i + 1) * (depth + 1)
+      std::make_move_iterator(allkeys.begin() + i * (depth + 1)),
+      std::make_move_iterator(allkeys.begin() + (i + 1) * (depth + 1))
     );
-    pprfs.push_back(PPRF(keys, points[i], outsize, domainsize));
+    pprfs.emplace_back(std::move(keys), points[i], outsize, domainsize, mode);
   }
 
   return pprfs;
 }
 
 
+
 ////////////////////////////////////////////////////////////////////////////////
 // BitPPRF SPECIFIC FUNCTIONS
 ////////////////////////////////////////////////////////////////////////////////
 
-BitPPRF::BitPPRF(BitString key, size_t domainsize)
-  : keysize(key.size()), domainsize(domainsize), depth((size_t) ceil(log2(domainsize)))
+namespace {
+
+// past this depth the last levels of a BitPPRF collapse into leafs that are each a
+//  bundle of 128 outputs, so the tree is this much shallower
+const size_t BUNDLE_DEPTH = 7;
+const size_t BUNDLE_BITS = size_t(1) << BUNDLE_DEPTH;
+
+bool packed(size_t depth) { return depth > BUNDLE_DEPTH; }
+
+// write the `n` leafs (every `stride`th block) out as the truth table, either one bit per
+//  leaf or a whole bundle of outputs per leaf when packed
+void writeImage(const block* leafs, size_t stride, bool packed, BitString& image) {
+  if (!packed) {
+    for (size_t i = 0; i < image.size(); i++) { image[i] = lowBit(leafs[i * stride]); }
+    return;
+  }
+  for (size_t i = 0, offset = 0; offset < image.nBytes(); i++, offset += sizeof(block)) {
+    std::memcpy(
+      image.data() + offset, &leafs[i * stride],
+      std::min(sizeof(block), image.nBytes() - offset)
+    );
+  }
+}
+
+}
+
+BitPPRF::BitPPRF(const BitString& key, size_t domainsize, TreeMode mode)
+  : keysize(key.size()), domainsize(domainsize), depth((size_t) ceil(log2(domainsize))),
+    mode(mode)
 {
-  std::vector<BitString> seed({key});
-  auto previous = std::make_shared<std::vector<BitString>>(seed);
-  this->levels.resize(depth);
-
-  // expand the tree but only hold onto the last level evaluated
-  for (size_t l = 0; l < depth; l++) {
-    auto next = std::make_shared<std::vector<BitString>>(previous->size() * 2);
-    size_t nodesize = (l == depth - 1) ? 1 : this->keysize;
-
-    BitString left(nodesize);
-    BitString right(nodesize);
-    for (size_t i = 0; i < previous->size(); i++) {
-      PRNG prng(toBlock((*previous)[i].data()));
-      (*next)[2 * i].resize(nodesize);
-      (*next)[2 * i + 1].resize(nodesize);
-      prng.get<uint8_t>((*next)[2 * i].data(), (nodesize + 7) / 8);
-      prng.get<uint8_t>((*next)[2 * i + 1].data(), (nodesize + 7) / 8);
-
-      left ^= (*next)[2 * i];
-      right ^= (*next)[2 * i + 1];
-    }
+  if (this->keysize > MAX_NODE_BITS) {
+    throw std::invalid_argument("[BitPPRF::BitPPRF] keys can be at most 128 bits");
+  }
+  const bool bundled = packed(depth);
+  const size_t treedepth = bundled ? depth - BUNDLE_DEPTH : depth;
+  NodeBuffer nodes = allocateNodes(size_t(1) << treedepth);
+  nodes[0] = toNode(key);
+  this->levels.resize(treedepth);
+
+  // expand the tree in place so only the last level evaluated is held onto
+  for (size_t l = 0, width = 1; l < treedepth; l++, width *= 2) {
+    size_t nodesize = (l < treedepth - 1) ? this->keysize : (bundled ? BUNDLE_BITS : 1);
+
+    expandInPlace(nodes.get(), width, 1, nodeMask(nodesize), mode);
+    block left, right;
+    sideSums(nodes.get(), 2 * width, 1, &left, &right);
 
     // save the left and right xors
-    this->levels[l] = std::make_pair(left, right);
-    previous = next;
+    this->levels[l] = std::make_pair(fromNode(left, nodesize), fromNode(right, nodesize));
+  }
+
+  // the payload is placed within the punctured bundle by a small pprf over its outputs,
+  //  seeded off the root so the image only depends on `key`
+  if (bundled) {
+    block root = toNode(key);
+    this->correction = std::make_shared<BitPPRF>(
+      fromNode(LEAF.ecbEncBlock(root) ^ root, this->keysize), BUNDLE_BITS, mode
+    );
   }
 
   // compresses leaf nodes into a single BitString
   this->_image = std::make_shared<BitString>(domainsize);
-  for (size_t i = 0; i < domainsize; i++) {
-    (*this->_image)[i] = (*previous)[i][0];
-  }
+  writeImage(nodes.get(), 1, bundled, *this->_image);
 
   this->expanded = true;
 }
 
-BitPPRF::BitPPRF(std::vector<BitString> keys, uint32_t point)
-  : keys(keys), point(point), keysize(keys[0].size()), domainsize(1 << keys.size()),
-    depth((size_t) ceil(log2(domainsize))), expanded(false) { }
+BitPPRF::BitPPRF(std::vector<BitString> keys, uint32_t point, TreeMode mode)
+  : point(point), keysize(keys[0].size()), domainsize(1 << keys.size()),
+    depth((size_t) ceil(log2(domainsize))), mode(mode), expanded(false)
+{
+  if (packed(this->depth)) {
+    throw std::invalid_argument("[BitPPRF::BitPPRF] packed pprfs need correction keys");
+  }
+  // moved in the body so the initializers above can still read from `keys`
+  this->keys = std::move(keys);
+}
+
+BitPPRF::BitPPRF(
+  std::vector<BitString> keys, std::vector<BitString> correction, uint32_t point,
+  TreeMode mode
+) : point(point), keysize(correction[0].size()),
+    domainsize(size_t(1) << (keys.size() + BUNDLE_DEPTH)),
+    depth(keys.size() + BUNDLE_DEPTH), mode(mode), expanded(false)
+{
+  this->keys = std::move(keys);
+  this->correction = std::make_shared<BitPPRF>(
+    std::move(correction), point % BUNDLE_BITS, mode
+  );
+}
 
 void BitPPRF::expand() {
-  std::vector<BitString> seed({BitString()});
-  auto previous = std::make_shared<std::vector<BitString>>(seed);
-
-  BitString path = BitString::fromUInt(this->point, this->depth).reverse();
-
-  for (size_t l = 0; l < depth; l++) {
-    auto next = std::make_shared<std::vector<BitString>>(previous->size() * 2);
-    size_t nodesize = (l == depth - 1) ? 1 : this->keysize;
-    size_t sibling;
-
-    BitString left(nodesize);
-    BitString right(nodesize);
-    for (size_t i = 0; i < previous->size(); i++) {
-      // if at the puncture point just insert the key for that
-      if ((*previous)[i].size() == 0 && !path[l]) {
-        sibling = 2 * i + 1;
-      } else if ((*previous)[i].size() == 0 && path[l]) {
-        sibling = 2 * i;
-      } else {
-        PRNG prng(toBlock((*previous)[i].data()));
-        (*next)[2 * i].resize(nodesize);
-        (*next)[2 * i + 1].resize(nodesize);
-        prng.get<uint8_t>((*next)[2 * i].data(), (nodesize + 7) / 8);
-        prng.get<uint8_t>((*next)[2 * i + 1].data(), (nodesize + 7) / 8);
-
-        left ^= (*next)[2 * i];
-        right ^= (*next)[2 * i + 1];
-      }
-    }
+  expand(this, 1);
+}
 
-    // for inner nodes just place the new key in the sibling position
-    if (l < depth - 1) {
-      (*next)[sibling] = this->keys[l] ^ (path[l] ? left : right);
+void BitPPRF::expand(std::vector<BitPPRF>& pprfs) {
+  // give each thread a contiguous range of trees to advance together
+  MULTI_TASK([&pprfs](size_t start, size_t end) {
+    if (start >= end) { return; }
+    expand(pprfs.data() + start, end - start);
+  }, pprfs.size());
+}
+
+void BitPPRF::expand(BitPPRF* pprfs, size_t n) {
+  if (n == 0) { return; }
+  if (n > INTERLEAVE) {
+    for (size_t i = 0; i < n; i += INTERLEAVE) {
+      expand(pprfs + i, std::min(INTERLEAVE, n - i));
     }
-    // at the leafs insert both the sibling and the puncture point
-    else {
-      left[0] ^= this->keys[l][0];
-      right[0] ^= this->keys[l][1];
-      (*next)[sibling] = path[l] ? left : right;
-      (*next)[this->point] = !path[l] ? left : right;
+    return;
+  }
+  const size_t keysize = pprfs[0].keysize, depth = pprfs[0].depth;
+  const size_t domainsize = pprfs[0].domainsize;
+  const bool bundled = (pprfs[0].correction != nullptr);
+  const TreeMode mode = pprfs[0].mode;
+  for (size_t t = 0; t < n; t++) {
+    if (
+      pprfs[t].keysize != keysize || pprfs[t].depth != depth
+      || pprfs[t].domainsize != domainsize || (pprfs[t].correction != nullptr) != bundled
+      || pprfs[t].mode != mode
+    ) {
+      throw std::invalid_argument("[BitPPRF::expand] pprfs expanded together must match");
     }
+  }
+  if (keysize > MAX_NODE_BITS) {
+    throw std::invalid_argument("[BitPPRF::expand] keys can be at most 128 bits");
+  }
+
+  // bundled trees are punctured at the bundle holding `point`
+  const size_t treedepth = bundled ? depth - BUNDLE_DEPTH : depth;
+  const size_t shift = bundled ? BUNDLE_DEPTH : 0;
+
+  NodeBuffer nodes = allocateNodes((size_t(1) << treedepth) * n);
+  std::fill(nodes.get(), nodes.get() + n, toBlock(0, 0));
+  std::vector<block> left(n), right(n);
+
+  for (size_t l = 0, width = 1; l < treedepth; l++, width *= 2) {
+    size_t nodesize = (l < treedepth - 1) ? keysize : (bundled ? BUNDLE_BITS : 1);
+
+    expandInPlace(nodes.get(), width, n, nodeMask(nodesize), mode);
+    sideSums(nodes.get(), 2 * width, n, left.data(), right.data());
 
-    previous = next;
+    for (size_t t = 0; t < n; t++) {
+      const BitPPRF& pprf = pprfs[t];
+      const size_t point = pprf.point >> shift;
+
+      // the punctured node on this level and which of its children is on the path
+      size_t punctured = point >> (treedepth - l);
+      bool bit = (point >> (treedepth - l - 1)) & 1;
+      block& on = nodes[(2 * punctured + bit) * n + t];
+      block& sibling = nodes[(2 * punctured + !bit) * n + t];
+
+      // the punctured node expands to junk, so cancel its children out of the sums
+      left[t] ^= nodes[(2 * punctured) * n + t];
+      right[t] ^= nodes[(2 * punctured + 1) * n + t];
+
+      // for inner nodes just place the new key in the sibling position
+      if (l < treedepth - 1) {
+        sibling = toNode(pprf.keys[l]) ^ (bit ? left[t] : right[t]);
+        on = toBlock(0, 0);
+      }
+      // bundles come as both sums with the punctured side masked by the correction image
+      else if (bundled) {
+        const BitString& sums = pprf.keys[l];
+        nodes[(2 * punctured) * n + t] = left[t] ^ toNode(sums[{0, BUNDLE_BITS}]);
+        nodes[(2 * punctured + 1) * n + t] = (
+          right[t] ^ toNode(sums[{BUNDLE_BITS, 2 * BUNDLE_BITS}])
+        );
+      }
+      // at the leafs insert both the sibling and the puncture point
+      else {
+        left[t] ^= toBlock(0, pprf.keys[l][0]);
+        right[t] ^= toBlock(0, pprf.keys[l][1]);
+        sibling = bit ? left[t] : right[t];
+        on = !bit ? left[t] : right[t];
+      }
+    }
   }
 
-  // compresses leaf nodes into a single BitString
-  this->_image = std::make_shared<BitString>(domainsize);
-  for (size_t i = 0; i < domainsize; i++) {
-    (*this->_image)[i] = (*previous)[i][0];
+  // the correction pprfs unmask the punctured bundles and put the payload in place
+  if (bundled) {
+    std::vector<BitPPRF> corrections;
+    corrections.reserve(n);
+    for (size_t t = 0; t < n; t++) { corrections.push_back(*pprfs[t].correction); }
+    expand(corrections.data(), n);
+
+    for (size_t t = 0; t < n; t++) {
+      nodes[(pprfs[t].point >> shift) * n + t] ^= toNode(*corrections[t]._image);
+    }
   }
 
-  this->expanded = true;
+  // compresses leaf nodes into a single BitString
+  for (size_t t = 0; t < n; t++) {
+    pprfs[t]._image = std::make_shared<BitString>(domainsize);
+    writeImage(nodes.get() + t, n, bundled, *pprfs[t]._image);
+    pprfs[t].expanded = true;
+  }
 }
 
-std::vector<BitPPRF> BitPPRF::sample(size_t n, size_t keysize, size_t domainsize) {
+std::vector<BitPPRF> BitPPRF::sample(
+  size_t n, size_t keysize, size_t domainsize, TreeMode mode
+) {
   std::vector<BitPPRF> pprfs(n);
 
-  MULTI_TASK([&pprfs, &keysize, &domainsize](size_t start, size_t end) {
+  MULTI_TASK([&pprfs, &keysize, &domainsize, &mode](size_t start, size_t end) {
     for (size_t i = start; i < end; i++) {
-      pprfs[i] = BitPPRF(BitString::sample(keysize), domainsize);
+      pprfs[i] = BitPPRF(BitString::sample(keysize), domainsize, mode);
     }
   }, n);
   return pprfs;
 }
 
+void BitPPRF::appendMessages(
+  bool payload, std::vector<std::pair<BitString, BitString>>& messages
+) const {
+  // the messages are the level left / right xors for the branch levels
+  messages.insert(messages.end(), this->levels.begin(), this->levels.end() - 1);
+  const std::pair<BitString, BitString>& leafs = this->levels.back();
+
+  // bundles are sent with both sums where the side to be punctured is masked, then the
+  //  correction pprf is shared to unmask it and set the payload
+  if (this->correction != nullptr) {
+    const BitString& mask = *this->correction->_image;
+    messages.push_back(std::make_pair(
+      leafs.first + (leafs.second ^ mask), (leafs.first ^ mask) + leafs.second
+    ));
+    this->correction->appendMessages(payload, messages);
+    return;
+  }
+
+  // leaf level is sent with both where payload is xor'd
+  BitString both = leafs.first + leafs.second;
+  std::pair<BitString, BitString> final_msg = std::make_pair(both, both);
+  final_msg.first[1] ^= payload;
+  final_msg.second[0] ^= payload;
+  messages.push_back(std::move(final_msg));
+}
+
 void BitPPRF::send(
-  std::vector<BitPPRF> pprfs, BitString payloads,
+  const std::vector<BitPPRF>& pprfs, const BitString& payloads,
   Channel channel, ROT::Sender rots
 ) {
   std::vector<std::pair<BitString, BitString>> messages;
+  if (!pprfs.empty()) { messages.reserve(pprfs.size() * pprfs[0].depth); }
   for (size_t i = 0; i < pprfs.size(); i++) {
-    // the messages are the level left / right xors for the branch levels
-    messages.insert(messages.end(), pprfs[i].levels.begin(), pprfs[i].levels.end() - 1);
-
-    // leaf level is sent with both where payload is xor'd
-    std::pair<BitString, BitString> leafs = pprfs[i].levels.back();
-    std::pair<BitString, BitString> final_msg = std::make_pair(
-      leafs.first + leafs.second, leafs.first + leafs.second
-    );
-    final_msg.first[1] ^= payloads[i];
-    final_msg.second[0] ^= payloads[i];
-    messages.push_back(final_msg);
+    pprfs[i].appendMessages(payloads[i], messages);
   }
 
   // do the oblivious transfer
@@ -340,15 +751,33 @@ void BitPPRF::send(
 }
 
 std::vector<BitPPRF> BitPPRF::receive(
-  std::vector<uint32_t> points, size_t keysize, size_t domainsize,
-  Channel channel, ROT::Receiver rots
+  const std::vector<uint32_t>& points, size_t keysize, size_t domainsize,
+  Channel channel, ROT::Receiver rots, TreeMode mode
 ) {
   size_t depth = (size_t) ceil(log2(domainsize));
+  const bool bundled = packed(depth);
+  const size_t treedepth = bundled ? depth - BUNDLE_DEPTH : depth;
   BitString choices;
 
   std::vector<size_t> sizes;
 
   for (const size_t& x : points) {
+    if (bundled) {
+      // want the sibling nodes for the path to the bundle holding `x` then the path to
+      //  `x` within the bundle for the correction pprf
+      choices += BitString::fromUInt(~(x >> BUNDLE_DEPTH), treedepth).reverse();
+      choices += BitString::fromUInt(~x, BUNDLE_DEPTH).reverse();
+
+      // both bundle sums come in a single ot between the two trees' branch levels
+      std::vector<size_t> branches(treedepth - 1, keysize);
+      sizes.insert(sizes.end(), branches.begin(), branches.end());
+      sizes.push_back(2 * BUNDLE_BITS);
+      branches.assign(BUNDLE_DEPTH - 1, keysize);
+      sizes.insert(sizes.end(), branches.begin(), branches.end());
+      sizes.push_back(2);
+      continue;
+    }
+
     // want the sibling nodes for the path to `x`
     choices += BitString::fromUInt(~x, depth).reverse();
 
@@ -362,12 +791,16 @@ std::vector<BitPPRF> BitPPRF::receive(
   std::vector<BitString> allkeys = rots.transfer(choices, sizes, channel);
 
   std::vector<BitPPRF> pprfs;
+  pprfs.reserve(points.size());
   for (size_t i = 0; i < points.size(); i++) {
-    std::vector<BitString> keys(
-      allkeys.begin() + i * depth,
-      allkeys.begin() + (i + 1) * depth
-    );
-    pprfs.push_back(BitPPRF(keys, points[i]));
+    auto begin = std::make_move_iterator(allkeys.begin() + i * depth);
+    std::vector<BitString> keys(begin, begin + treedepth);
+    if (!bundled) {
+      pprfs.emplace_back(std::move(keys), points[i], mode);
+      continue;
+    }
+    std::vector<BitString> correction(begin + treedepth, begin + depth);
+    pprfs.emplace_back(std::move(keys), std::move(correction), points[i], mode);
   }
 
   return pprfs;
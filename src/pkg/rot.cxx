@@ -117,7 +117,7 @@ std::pair<bool, BitString> Receiver::get(size_t size) {
 ////////////////////////////////////////////////////////////////////////////////
 
 void Sender::transfer(
-  std::vector<std::pair<BitString, BitString>> messages,
+  const std::vector<std::pair<BitString, BitString>>& messages,
   Channel channel
 ) {
   if (messages.size() > this->remaining()) {
@@ -127,23 +127,29 @@ void Sender::transfer(
   BitString swap(messages.size());
   channel->read(swap.data(), swap.nBytes());
 
+  size_t total = 0;
+  for (const auto& message : messages) { total += 2 * message.first.size(); }
+
   BitString outgoing;
+  outgoing.reserve(total);
   for (size_t i = 0; i < messages.size(); i++) {
-    BitString m0, m1, r0, r1;
-    std::tie(m0, m1) = messages[i];
-    std::tie(r0, r1) = this->get(m0.size());
-
-    m0 ^= swap[i] ? r1 : r0;
-    m1 ^= swap[i] ? r0 : r1;
-    outgoing += m0;
-    outgoing += m1;
+    BitString r0, r1;
+    std::tie(r0, r1) = this->get(messages[i].first.size());
+
+    // mask in place in the random ot strings rather than copying the messages
+    BitString& c0 = swap[i] ? r1 : r0;
+    BitString& c1 = swap[i] ? r0 : r1;
+    c0 ^= messages[i].first;
+    c1 ^= messages[i].second;
+    outgoing += c0;
+    outgoing += c1;
   }
 
   channel->write(outgoing.data(), outgoing.nBytes());
 }
 
 std::vector<BitString> Receiver::transfer(
-  BitString choices, size_t mbits, Channel channel
+  const BitString& choices, size_t mbits, Channel channel
 ) {
   if (choices.size() > this->remaining()) {
     throw std::runtime_error(
@@ -162,18 +168,19 @@ std::vector<BitString> Receiver::transfer(
   channel->read(incoming.data(), incoming.nBytes());
 
   std::vector<BitString> messages;
+  messages.reserve(choices.size());
   for (size_t i = 0, j = 0; i < choices.size(); i++, j += 2 * mbits) {
     size_t idx = choices[i] ? j + mbits : j;
-    BitString mb = incoming[{idx, idx + mbits}];
+    BitString& mb = reserved[i].second;
 
-    mb ^= reserved[i].second;
-    messages.push_back(mb);
+    mb ^= incoming.view(idx, idx + mbits);
+    messages.push_back(std::move(mb));
   }
   return messages;
 }
 
 std::vector<BitString> Receiver::transfer(
-  BitString choices, std::vector<size_t> mbits, Channel channel
+  const BitString& choices, const std::vector<size_t>& mbits, Channel channel
 ) {
   if (choices.size() > this->remaining()) {
     throw std::runtime_error(
@@ -195,12 +202,13 @@ std::vector<BitString> Receiver::transfer(
   channel->read(incoming.data(), incoming.nBytes());
 
   std::vector<BitString> messages;
+  messages.reserve(choices.size());
   for (size_t i = 0, j = 0; i < choices.size(); j += 2 * mbits[i], i++) {
     size_t idx = choices[i] ? j + mbits[i] : j;
-    BitString mb = incoming[{idx, idx + mbits[i]}];
+    BitString& mb = reserved[i].second;
 
-    mb ^= reserved[i].second;
-    messages.push_back(mb);
+    mb ^= incoming.view(idx, idx + mbits[i]);
+    messages.push_back(std::move(mb));
   }
   return messages;
 }
@@ -231,7 +239,7 @@ void Sender::transfer(BitString m0, BitString m1, Channel channel) {
   channel->write(outgoing.data(), outgoing.nBytes());
 }
 
-BitString Receiver::transfer(BitString choices, Channel channel) {
+BitString Receiver::transfer(const BitString& choices, Channel channel) {
   if (choices.size() > this->remaining()) {
     throw std::runtime_error(
       "[Receiver::transfer(BitString, ...)] out of random ots"
@@ -249,8 +257,8 @@ BitString Receiver::transfer(BitString choices, Channel channel) {
   BitString messages(choices.size() * 2);
   channel->read(messages.data(), messages.nBytes());
 
-  BitString m0 = messages[{0, choices.size()}];
-  BitString m1 = messages[{choices.size(), choices.size() * 2}];
+  BitStringView m0 = messages.view(0, choices.size());
+  BitStringView m1 = messages.view(choices.size(), choices.size() * 2);
 
   BitString out(choices.size());
   for (size_t i = 0; i < choices.size(); i++) {
@@ -270,32 +278,36 @@ const BitString MOCKING_KEY = BitString(
 
 Sender Sender::mocked(size_t size) {
   std::vector<std::pair<BitString, BitString>> messages;
+  messages.reserve(size);
   PRF<BitString> prf(MOCKING_KEY);
 
   for (size_t i = 0; i < 2 * size; i += 2) {
     BitString m0 = prf(i, Sender::DEFAULT_ELEMENT_SIZE);
     BitString m1 = prf(i + 1, Sender::DEFAULT_ELEMENT_SIZE);
-    messages.push_back(std::make_pair(m0, m1));
+    messages.push_back(std::make_pair(std::move(m0), std::move(m1)));
   }
-  return Sender(messages);
+  return Sender(std::move(messages));
 }
 
 Receiver Receiver::mocked(size_t size) {
   std::vector<std::pair<bool, BitString>> messages;
+  messages.reserve(size);
   PRF<BitString> prf(MOCKING_KEY);
 
   BitString b = BitString::sample(size);
   for (size_t i = 0; i < 2 * size; i += 2) {
     BitString mb = prf((b[i / 2] ? i + 1 : i),  Sender::DEFAULT_ELEMENT_SIZE);
-    messages.push_back(std::make_pair(b[i / 2], mb));
+    messages.push_back(std::make_pair(b[i / 2], std::move(mb)));
   }
-  return Receiver(messages);
+  return Receiver(std::move(messages));
 }
 
 
 std::pair<Sender, Receiver> mocked(size_t total) {
   std::vector<std::pair<BitString, BitString>> sender;
   std::vector<std::pair<bool, BitString>> receiver;
+  sender.reserve(total);
+  receiver.reserve(total);
 
   BitString b = BitString::sample(total);
   for (size_t i = 0; i < total; i++) {
@@ -303,11 +315,11 @@ std::pair<Sender, Receiver> mocked(size_t total) {
     BitString m1 = BitString::sample(Sender::DEFAULT_ELEMENT_SIZE);
     BitString mb = b[i] ? m1 : m0;
 
-    sender.push_back(std::make_pair(m0, m1));
-    receiver.push_back(std::make_pair(b[i], mb));
+    sender.push_back(std::make_pair(std::move(m0), std::move(m1)));
+    receiver.push_back(std::make_pair(b[i], std::move(mb)));
   }
 
-  return std::make_pair(Sender(sender), Receiver(receiver));
+  return std::make_pair(Sender(std::move(sender)), Receiver(std::move(receiver)));
 }
 
 }
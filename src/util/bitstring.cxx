@@ -1,13 +1,194 @@
 #include "util/bitstring.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <stdexcept>
 #include <tuple>
+#include <utility>
 
-#include <openssl/bn.h>
+#include <immintrin.h>
 #include <openssl/evp.h>
 
+#include "util/random.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// WORD KERNELS
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// applies `dst[i] = dst[i] op src[i]` across `n` words
+using WordKernel = void (*)(uint64_t* dst, const uint64_t* src, size_t n);
+
+void xorScalar(uint64_t* dst, const uint64_t* src, size_t n) {
+  for (size_t i = 0; i < n; i++) { dst[i] ^= src[i]; }
+}
+
+void andScalar(uint64_t* dst, const uint64_t* src, size_t n) {
+  for (size_t i = 0; i < n; i++) { dst[i] &= src[i]; }
+}
+
+void orScalar(uint64_t* dst, const uint64_t* src, size_t n) {
+  for (size_t i = 0; i < n; i++) { dst[i] |= src[i]; }
+}
+
+void notScalar(uint64_t* dst, const uint64_t* src, size_t n) {
+  for (size_t i = 0; i < n; i++) { dst[i] = ~src[i]; }
+}
+
+// avx2 versions work on four words at a time and finish up with the scalar loop
+#define AVX2_KERNEL(name, expr, tail)                                          \
+  __attribute__((target("avx2")))                                              \
+  void name(uint64_t* dst, const uint64_t* src, size_t n) {                    \
+    size_t i = 0;                                                              \
+    for (; i + 4 <= n; i += 4) {                                               \
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)); \
+      __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)); \
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), expr);          \
+    }                                                                          \
+    tail(dst + i, src + i, n - i);                                             \
+  }
+
+AVX2_KERNEL(xorAVX2, _mm256_xor_si256(a, b), xorScalar)
+AVX2_KERNEL(andAVX2, _mm256_and_si256(a, b), andScalar)
+AVX2_KERNEL(orAVX2, _mm256_or_si256(a, b), orScalar)
+AVX2_KERNEL(notAVX2, _mm256_xor_si256(b, _mm256_set1_epi64x(-1)), notScalar)
+
+#undef AVX2_KERNEL
+
+// xor together (a[i] & b[i]) across `n` words; the parity of the result is ⟨a,b⟩
+using AndXorKernel = uint64_t (*)(const uint64_t* a, const uint64_t* b, size_t n);
+
+// same as above but for `a` against each of `m` other vectors
+using AndXorBatchKernel = void (*)(
+  const uint64_t* a, const uint64_t* const* b, size_t m, size_t n, uint64_t* out
+);
+
+// number of set bits across `n` words
+using PopcountKernel = size_t (*)(const uint64_t* a, size_t n);
+
+uint64_t andXorScalar(const uint64_t* a, const uint64_t* b, size_t n) {
+  uint64_t acc = 0;
+  for (size_t i = 0; i < n; i++) { acc ^= a[i] & b[i]; }
+  return acc;
+}
+
+void andXorBatchScalar(
+  const uint64_t* a, const uint64_t* const* b, size_t m, size_t n, uint64_t* out
+) {
+  for (size_t j = 0; j < m; j++) { out[j] = andXorScalar(a, b[j], n); }
+}
+
+size_t popcountScalar(const uint64_t* a, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) { count += __builtin_popcountll(a[i]); }
+  return count;
+}
+
+__attribute__((target("avx2")))
+uint64_t reduceAVX2(__m256i acc) {
+  return (
+    _mm256_extract_epi64(acc, 0) ^ _mm256_extract_epi64(acc, 1)
+    ^ _mm256_extract_epi64(acc, 2) ^ _mm256_extract_epi64(acc, 3)
+  );
+}
+
+__attribute__((target("avx2")))
+uint64_t andXorAVX2(const uint64_t* a, const uint64_t* b, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    acc = _mm256_xor_si256(acc, _mm256_and_si256(x, y));
+  }
+  return reduceAVX2(acc) ^ andXorScalar(a + i, b + i, n - i);
+}
+
+// loads each word of `a` once and uses it against four vectors at a time
+__attribute__((target("avx2")))
+void andXorBatchAVX2(
+  const uint64_t* a, const uint64_t* const* b, size_t m, size_t n, uint64_t* out
+) {
+  size_t j = 0;
+  for (; j + 4 <= m; j += 4) {
+    __m256i acc[4] = {
+      _mm256_setzero_si256(), _mm256_setzero_si256(),
+      _mm256_setzero_si256(), _mm256_setzero_si256()
+    };
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      for (size_t k = 0; k < 4; k++) {
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b[j + k] + i));
+        acc[k] = _mm256_xor_si256(acc[k], _mm256_and_si256(x, y));
+      }
+    }
+    for (size_t k = 0; k < 4; k++) {
+      out[j + k] = reduceAVX2(acc[k]) ^ andXorScalar(a + i, b[j + k] + i, n - i);
+    }
+  }
+  for (; j < m; j++) { out[j] = andXorAVX2(a, b[j], n); }
+}
+
+__attribute__((target("popcnt")))
+size_t popcountHW(const uint64_t* a, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) { count += _mm_popcnt_u64(a[i]); }
+  return count;
+}
+
+struct Kernels {
+  WordKernel xor_, and_, or_, not_;
+  AndXorKernel andXor;
+  AndXorBatchKernel andXorBatch;
+  PopcountKernel popcount;
+};
+
+// pick the widest kernels the cpu supports (decided once at first use)
+const Kernels& kernels() {
+  static const Kernels selected = []() {
+    __builtin_cpu_init();
+    Kernels k{
+      xorScalar, andScalar, orScalar, notScalar,
+      andXorScalar, andXorBatchScalar, popcountScalar
+    };
+    if (__builtin_cpu_supports("avx2")) {
+      k = Kernels{
+        xorAVX2, andAVX2, orAVX2, notAVX2,
+        andXorAVX2, andXorBatchAVX2, popcountScalar
+      };
+    }
+    if (__builtin_cpu_supports("popcnt")) { k.popcount = popcountHW; }
+    return k;
+  }();
+  return selected;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTRUCTORS
+////////////////////////////////////////////////////////////////////////////////
+
+BitString::BitString(std::vector<unsigned char> bytes)
+  : words(nWords(bytes.size() * 8)), size_(bytes.size() * 8)
+{
+  std::memcpy(this->data(), bytes.data(), bytes.size());
+}
+
+BitString::BitString(std::vector<unsigned char> bytes, size_t size)
+  : words(nWords(size)), size_(size)
+{
+  std::memcpy(this->data(), bytes.data(), std::min(bytes.size(), this->words.size() * 8));
+}
+
+BitString::BitString(unsigned char* bytes, size_t size) : words(nWords(size)), size_(size) {
+  std::memcpy(this->data(), bytes, (size + 7) / 8);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // SERIALIZE / DESERIALIZE OPERATORS
 ////////////////////////////////////////////////////////////////////////////////
@@ -62,10 +243,13 @@ std::vector<uint32_t> BitString::toUInts(size_t bits) const {
 
 bool BitString::operator==(const BitString& other) const {
   if (this->size() != other.size()) { return false; }
-  for (size_t i = 0; i < this->size(); i++) {
-    if (this->operator[](i) != other[i]) { return false; }
+  if (this->size() == 0) { return true; }
+
+  size_t last = this->words.size() - 1;
+  if (std::memcmp(this->words.data(), other.words.data(), last * sizeof(uint64_t)) != 0) {
+    return false;
   }
-  return true;
+  return ((this->words[last] ^ other.words[last]) & this->lastWordMask()) == 0;
 }
 
 bool BitString::operator!=(const BitString& other) const {
@@ -77,10 +261,12 @@ bool BitString::operator<(const BitString& other) const {
     throw std::runtime_error("[BitString::operator<] cannot compare bitstrings of different sizes");
   }
 
-  for (int i = this->bytes.size() - 1; i >= 0; i--) {
-    if (this->bytes[i] == other.bytes[i])     { continue;     }
-    else if (this->bytes[i] < other.bytes[i]) { return true;  }
-    else                                      { return false; }
+  for (int i = this->words.size() - 1; i >= 0; i--) {
+    uint64_t mask = (i == this->words.size() - 1) ? this->lastWordMask() : ~uint64_t(0);
+    uint64_t ours = this->words[i] & mask, theirs = other.words[i] & mask;
+    if (ours == theirs)     { continue;     }
+    else if (ours < theirs) { return true;  }
+    else                    { return false; }
   }
   return false;
 }
@@ -91,19 +277,28 @@ bool BitString::operator<(const BitString& other) const {
 
 BitString& BitString::operator=(const BitString& other) {
   if (this != &other) {
-    bytes = other.bytes;
+    words = other.words;
     size_ = other.size_;
   }
   return *this;
 }
 
+BitString& BitString::operator=(BitString&& other) noexcept {
+  if (this != &other) {
+    words = std::move(other.words);
+    size_ = other.size_;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
 const bool BitString::operator[](size_t i) const {
   if (i >= size_) {
     throw std::out_of_range(
         "[BitString::operator[](size_t)]" + std::to_string(i) + " is out of range"
     );
   }
-  return ((bytes[i / 8] >> (i % 8)) & 0x01);
+  return ((words[i / 64] >> (i % 64)) & 0x01);
 }
 
 BitString BitString::operator[](std::pair<size_t, size_t> range) const {
@@ -125,48 +320,86 @@ BitString BitString::operator[](std::pair<size_t, size_t> range) const {
     );
   }
 
-  BitString substring(to - from);
-  for (size_t i = from; i < to; i++) {
-    substring[i - from] = this->operator[](i);
-  }
-  return substring;
+  return BitStringView(*this, from, to - from).toBitString();
+}
 
+BitStringView BitString::view(size_t from, size_t to) const {
+  if (to > size_) {
+    throw std::out_of_range(
+      "[BitString::view] to=" + std::to_string(to) + " is out of range"
+    );
+  } else if (from > to) {
+    throw std::invalid_argument(
+      "[BitString::view] invalid range ("
+      + std::to_string(from) + " > " + std::to_string(to) + ")"
+    );
+  }
+  return BitStringView(*this, from, to - from);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // CONCATENATION OPERATORS
 ////////////////////////////////////////////////////////////////////////////////
 
-// TODO: just append in the special case where bytes.size() * 8 == size_
 BitString& BitString::operator+=(const BitString& other) {
-  this->size_ += other.size_;
-  bytes.resize((this->size_ + 7) / 8);
+  // appending to ourselves would read from storage that is being resized
+  if (&other == this) {
+    BitString copy(other);
+    return this->operator+=(copy);
+  }
+  if (other.size_ == 0) { return *this; }
 
-  for (size_t i = 0; i < other.size_; i++) {
-    this->operator[](i + this->size_ - other.size_) = other[i];
+  size_t start = this->size_;
+  this->size_ += other.size_;
+  words.resize(nWords(this->size_));
+
+  size_t w = start / 64, shift = start % 64;
+  if (start % 8 == 0) {
+    // byte aligned so the other bitstring's bytes can be copied in directly
+    std::memcpy(this->data() + (start / 8), other.data(), other.nBytes());
+  } else {
+    // otherwise shift each word across the boundary between two of ours
+    this->words[w] &= (uint64_t(1) << shift) - 1;
+    for (size_t i = 0; i < other.words.size(); i++) {
+      this->words[w + i] |= other.words[i] << shift;
+      if (w + i + 1 < this->words.size()) {
+        this->words[w + i + 1] = other.words[i] >> (64 - shift);
+      }
+    }
   }
 
   return *this;
 }
 
-BitString BitString::operator+(const BitString& other) const {
-  BitString result(*this);
+BitString BitString::operator+(const BitString& other) const & {
+  BitString result;
+  result.reserve(this->size_ + other.size_);
+  result = *this;
   result += other;
   return result;
 }
 
+BitString BitString::operator+(const BitString& other) && {
+  this->reserve(this->size_ + other.size_);
+  *this += other;
+  return std::move(*this);
+}
+
 BitString& BitString::operator+=(const bool& bit) {
   this->size_++;
-  bytes.resize((this->size_ + 7) / 8);
+  words.resize(nWords(this->size_));
   this->operator[](this->size_ - 1) = bit;
   return *this;
 }
 
-BitString BitString::concat(const std::vector<BitString> in) {
-  if (in.size() == 0) { return BitString(0); }
-  BitString out = in[0];
-  for (size_t i = 1; i < in.size(); i++) {
-    out += in[i];
+BitString BitString::concat(const std::vector<BitString>& in) {
+  size_t total = 0;
+  for (const BitString& bs : in) { total += bs.size(); }
+
+  BitString out;
+  out.reserve(total);
+  for (const BitString& bs : in) {
+    out += bs;
   }
   return out;
 }
@@ -193,55 +426,73 @@ BitString& BitString::operator^=(const BitString& other) {
     throw std::domain_error("[BitString::operator^=] size mismatch ("
         + std::to_string(other.size()) + " vs. " + std::to_string(this->size()) + ")");
   }
-  for (size_t i = 0; i < this->bytes.size(); i++) {
-    this->bytes[i] = this->bytes[i] ^ other.bytes[i];
+  kernels().xor_(this->words.data(), other.words.data(), this->words.size());
+  return *this;
+}
+
+BitString& BitString::operator^=(const BitStringView& other) {
+  if (other.size() != this->size()) {
+    throw std::domain_error("[BitString::operator^=] size mismatch ("
+        + std::to_string(other.size()) + " vs. " + std::to_string(this->size()) + ")");
+  }
+  for (size_t i = 0; i < this->words.size(); i++) {
+    this->words[i] ^= other.word(i);
   }
   return *this;
 }
 
-BitString BitString::operator^(const BitString& other) const {
+BitString BitString::operator^(const BitString& other) const & {
   BitString result(*this);
   result ^= other;
   return result;
 }
 
+BitString BitString::operator^(const BitString& other) && {
+  *this ^= other;
+  return std::move(*this);
+}
+
 BitString& BitString::operator&=(const BitString& other) {
   if (other.size() != this->size()) {
     throw std::domain_error("[BitString::operator&=] size mismatch");
   }
-  for (size_t i = 0; i < this->bytes.size(); i++) {
-    this->bytes[i] = this->bytes[i] & other.bytes[i];
-  }
+  kernels().and_(this->words.data(), other.words.data(), this->words.size());
   return *this;
 }
 
-BitString BitString::operator&(const BitString& other) const {
+BitString BitString::operator&(const BitString& other) const & {
   BitString result(*this);
   result &= other;
   return result;
 }
 
+BitString BitString::operator&(const BitString& other) && {
+  *this &= other;
+  return std::move(*this);
+}
+
 BitString& BitString::operator|=(const BitString& other) {
   if (other.size() != this->size()) {
     throw std::domain_error("[BitString::operator|=] size mismatch");
   }
-  for (size_t i = 0; i < this->bytes.size(); i++) {
-    this->bytes[i] = this->bytes[i] | other.bytes[i];
-  }
+  kernels().or_(this->words.data(), other.words.data(), this->words.size());
   return *this;
 }
 
-BitString BitString::operator|(const BitString& other) const {
+BitString BitString::operator|(const BitString& other) const & {
   BitString result(*this);
   result |= other;
   return result;
 }
 
+BitString BitString::operator|(const BitString& other) && {
+  *this |= other;
+  return std::move(*this);
+}
+
 BitString BitString::operator~() const {
-  BitString result(*this);
-  for (size_t i = 0; i < result.nBytes(); i++) {
-    result.bytes[i] = ~result.bytes[i];
-  }
+  BitString result(this->size_);
+  kernels().not_(result.words.data(), this->words.data(), this->words.size());
   return result;
 }
 
@@ -249,9 +500,37 @@ bool BitString::operator*(const BitString& other) const {
   if (other.size() != this->size()) {
     throw std::domain_error("[BitString::operator*] size mismatch");
   }
-  BitString result(*this);
-  result &= other;
-  return (result.weight() % 2 != 0);
+  if (this->size() == 0) { return false; }
+
+  // full words go through the kernel while the last one is masked
+  size_t last = this->words.size() - 1;
+  uint64_t acc = kernels().andXor(this->words.data(), other.words.data(), last);
+  acc ^= this->words[last] & other.words[last] & this->lastWordMask();
+  return __builtin_parityll(acc);
+}
+
+BitString BitString::innerProducts(const BitString* others, size_t n) const {
+  std::vector<const uint64_t*> ptrs(n);
+  for (size_t j = 0; j < n; j++) {
+    if (others[j].size() != this->size()) {
+      throw std::domain_error("[BitString::innerProducts] size mismatch");
+    }
+    ptrs[j] = others[j].words.data();
+  }
+
+  BitString out(n);
+  if (this->size() == 0) { return out; }
+
+  size_t last = this->words.size() - 1;
+  std::vector<uint64_t> acc(n);
+  kernels().andXorBatch(this->words.data(), ptrs.data(), n, last, acc.data());
+
+  uint64_t mine = this->words[last] & this->lastWordMask();
+  for (size_t j = 0; j < n; j++) {
+    acc[j] ^= mine & others[j].words[last];
+    if (__builtin_parityll(acc[j])) { out.words[j / 64] |= uint64_t(1) << (j % 64); }
+  }
+  return out;
 }
 
 BitString BitString::tensor(const BitString& other) const {
@@ -262,6 +541,62 @@ BitString BitString::tensor(const BitString& other) const {
   return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// BITSTRING VIEW
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t BitStringView::word(size_t i) const {
+  size_t bit = this->offset + 64 * i;
+  size_t w = bit / 64, shift = bit % 64;
+
+  // stitch together the two words the range straddles
+  uint64_t out = this->words[w] >> shift;
+  if (shift != 0 && w + 1 < this->nwords) {
+    out |= this->words[w + 1] << (64 - shift);
+  }
+
+  // zero anything past the end of the view
+  if (64 * (i + 1) > this->size_ && this->size_ % 64 != 0) {
+    out &= (uint64_t(1) << (this->size_ % 64)) - 1;
+  }
+  return out;
+}
+
+bool BitStringView::operator==(const BitStringView& other) const {
+  if (this->size() != other.size()) { return false; }
+  for (size_t i = 0; i < this->nWords(); i++) {
+    if (this->word(i) != other.word(i)) { return false; }
+  }
+  return true;
+}
+
+bool BitStringView::operator*(const BitStringView& other) const {
+  if (this->size() != other.size()) {
+    throw std::domain_error("[BitStringView::operator*] size mismatch");
+  }
+  uint64_t acc = 0;
+  for (size_t i = 0; i < this->nWords(); i++) {
+    acc ^= this->word(i) & other.word(i);
+  }
+  return __builtin_parityll(acc);
+}
+
+size_t BitStringView::weight() const {
+  size_t w = 0;
+  for (size_t i = 0; i < this->nWords(); i++) {
+    w += __builtin_popcountll(this->word(i));
+  }
+  return w;
+}
+
+BitString BitStringView::toBitString() const {
+  BitString out(this->size_);
+  for (size_t i = 0; i < out.words.size(); i++) {
+    out.words[i] = this->word(i);
+  }
+  return out;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // ERROR CORRECTING CODE
 ////////////////////////////////////////////////////////////////////////////////
@@ -308,11 +643,12 @@ size_t ECC::CODEWORD_SIZE(const size_t& msg_size) {
 
 ////////////////////////////////////////////////////////////////////////////////
 size_t BitString::weight() const {
-  size_t w = 0;
-  for (size_t i = 0; i < size(); i++) {
-    if (this->operator[](i)) { w++; }
-  }
-  return w;
+  if (this->size() == 0) { return 0; }
+  size_t last = this->words.size() - 1;
+  return (
+    kernels().popcount(this->words.data(), last)
+    + __builtin_popcountll(this->words[last] & this->lastWordMask())
+  );
 }
 
 
@@ -324,26 +660,10 @@ BitString BitString::reverse() const {
   return out;
 }
 
-// TODO: there appears to be a weird bug where this isn't uniform for some inputs of `size`
-//       try to reproduce with size = 9
-//       (100000001 comes up way to often and no other bitstrings end with a 1)
 BitString BitString::sample(size_t size) {
-  // generate the output
-  BIGNUM* bits = BN_new();
-  BN_rand(bits, size, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
-
-  // convert to bits
-  std::vector<unsigned char> bytes((size + 7) / 8);
-
-  BN_bn2bin(bits, bytes.data());
-
-  // free used memory
-  BN_clear_free(bits);
-
-  return BitString(bytes, size);
+  return CSPRNG::local().sampleBits(size);
 }
 
-
 std::vector<unsigned char> BitString::expand() {
   std::vector<unsigned char> out;
   for (size_t i = 0; i < size_; i++) {
@@ -358,7 +678,7 @@ BitString BitString::aes(size_t size) {
     throw std::runtime_error("[BitString::aes] EVP_CIPHER_CTX_new error");
   }
 
-  std::vector<unsigned char> key(this->bytes);
+  std::vector<unsigned char> key = this->toBytes();
 
   // ensure the key is large enough
   const size_t BLOCK_SIZE = 16;
@@ -395,7 +715,7 @@ BitString BitString::aes(size_t size) {
   return BitString(output, size);
 }
 
-BitString::BitString(const std::string& str) : bytes((str.size() + 7) / 8), size_(str.size()) {
+BitString::BitString(const std::string& str) : words(nWords(str.size())), size_(str.size()) {
   for (size_t i = 0; i < str.size(); i++) {
     if (str[i] == '1') {
       this->operator[](i) = true;
@@ -421,8 +741,9 @@ std::string BitString::toHexString() const {
   std::ostringstream out;
   out << std::hex << std::setfill('0');
 
-  for (unsigned char byte : this->bytes) {
-    out << std::setw(2) << static_cast<int>(byte);
+  const unsigned char* bytes = this->data();
+  for (size_t i = 0; i < this->nBytes(); i++) {
+    out << std::setw(2) << static_cast<int>(bytes[i]);
   }
 
   return out.str();
@@ -20,11 +20,11 @@ void MULTI_TASK(std::function<void(size_t, size_t)> func, size_t num_tasks) {
       threads.emplace_back(func, thread_id, thread_id + 1);
     }
   } else {
-    // Start all threads based on the determined THREAD_COUNT
-    for (size_t thread_id = 0; thread_id < THREAD_COUNT; thread_id++) {
-      size_t start = thread_id * ((num_tasks + THREAD_COUNT - 1) / THREAD_COUNT);
-      size_t end = std::min(start + ((num_tasks + THREAD_COUNT - 1) / THREAD_COUNT), num_tasks);
-      threads.emplace_back(func, start, end);
+    // Start all threads based on the determined THREAD_COUNT (rounding the chunk size up
+    //  can leave the last threads with nothing to do, so those aren't started)
+    size_t chunk = (num_tasks + THREAD_COUNT - 1) / THREAD_COUNT;
+    for (size_t start = 0; start < num_tasks; start += chunk) {
+      threads.emplace_back(func, start, std::min(start + chunk, num_tasks));
     }
   }
 
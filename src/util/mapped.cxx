@@ -0,0 +1,94 @@
+#include "util/mapped.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/concurrency.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// MAPPED FILE
+////////////////////////////////////////////////////////////////////////////////
+
+MappedFile::~MappedFile() {
+  if (this->length > 0) { munmap(this->bytes, this->length); }
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) { return nullptr; }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  // mmap refuses empty files
+  size_t length = info.st_size;
+  if (length == 0) {
+    close(fd);
+    return std::shared_ptr<const MappedFile>(new MappedFile(nullptr, 0));
+  }
+
+  void* bytes = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (bytes == MAP_FAILED) { return nullptr; }
+
+  return std::shared_ptr<const MappedFile>(
+    new MappedFile(static_cast<unsigned char*>(bytes), length)
+  );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CHECKSUM
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// bytes hashed per chunk, fixed so the result is the same for any thread count
+const size_t CHECKSUM_CHUNK = 1 << 20;
+
+// fnv-1a style mixing over 64 bit words (the tail is zero padded)
+uint64_t mix(uint64_t hash, uint64_t word) {
+  hash ^= word;
+  hash *= 0x100000001b3ull;
+  return hash ^ (hash >> 29);
+}
+
+uint64_t hashChunk(const unsigned char* bytes, size_t n) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    hash = mix(hash, word);
+  }
+  if (i < n) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + i, n - i);
+    hash = mix(hash, word);
+  }
+  return mix(hash, n);
+}
+
+}
+
+uint64_t checksum(const unsigned char* bytes, size_t n) {
+  const size_t nchunks = (n + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+  std::vector<uint64_t> hashes(nchunks);
+  MULTI_TASK([bytes, n, &hashes](size_t start, size_t end) {
+    for (size_t c = start; c < end; c++) {
+      size_t from = c * CHECKSUM_CHUNK;
+      hashes[c] = hashChunk(bytes + from, std::min(CHECKSUM_CHUNK, n - from));
+    }
+  }, nchunks);
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (uint64_t chunk : hashes) { hash = mix(hash, chunk); }
+  return mix(hash, n);
+}
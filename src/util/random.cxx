@@ -7,37 +7,79 @@
 
 #include <boost/filesystem.hpp>
 #include <gmpxx.h>
-#include <openssl/bn.h>
+#include <openssl/rand.h>
 
 #include <cryptoTools/Common/block.h>
 #include <cryptoTools/Crypto/AES.h>
 
 using namespace osuCrypto;
 
-uint32_t sampleLessThan(uint32_t max) {
-  // convert max to an OpenSSL BIGNUM
-  BIGNUM* bn_max = BN_new();
-  BN_set_word(bn_max, max);
-
-  // generate the output
-  BIGNUM* bn_out = BN_new();
-  BN_rand_range(bn_out, bn_max);
+////////////////////////////////////////////////////////////////////////////////
+// CSPRNG
+////////////////////////////////////////////////////////////////////////////////
 
-  // convert back to uint64_t
-  uint32_t out = BN_get_word(bn_out);
+CSPRNG::CSPRNG() {
+  block seed;
+  if (RAND_bytes(reinterpret_cast<unsigned char*>(&seed), sizeof(block)) != 1) {
+    throw std::runtime_error("[CSPRNG] failure seeding from the os");
+  }
+  this->prng.SetSeed(seed);
+}
 
-  // free used memory
-  BN_clear_free(bn_max);
-  BN_clear_free(bn_out);
+CSPRNG& CSPRNG::local() {
+  thread_local CSPRNG instance;
+  return instance;
+}
 
+BitString CSPRNG::sampleBits(size_t size) {
+  BitString out(size);
+  this->fill(out.data(), out.nBytes());
+  out.resize(size);  // clears anything past the end of a partial last word
   return out;
 }
 
+// Lemire's multiply-shift: the high half of x * max is uniform in [0, max) once the
+//  low half is outside the (2³² mod max) values that would bias it
+uint32_t CSPRNG::lessThan(uint32_t max) {
+  if (max == 0) {
+    throw std::invalid_argument("[CSPRNG::lessThan] max must be positive");
+  }
+  uint64_t m = uint64_t(this->prng.get<uint32_t>()) * max;
+  if (uint32_t(m) < max) {
+    uint32_t threshold = (0 - max) % max;
+    while (uint32_t(m) < threshold) {
+      m = uint64_t(this->prng.get<uint32_t>()) * max;
+    }
+  }
+  return m >> 32;
+}
+
+void CSPRNG::lessThan(uint32_t* out, size_t n, uint32_t max) {
+  if (max == 0) {
+    throw std::invalid_argument("[CSPRNG::lessThan] max must be positive");
+  }
+  this->prng.get<uint32_t>(out, n);
+
+  uint32_t threshold = (0 - max) % max;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t m = uint64_t(out[i]) * max;
+    // rejections are rare (< max / 2³²) so just redraw those one at a time
+    while (uint32_t(m) < threshold) {
+      m = uint64_t(this->prng.get<uint32_t>()) * max;
+    }
+    out[i] = m >> 32;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t sampleLessThan(uint32_t max) {
+  return CSPRNG::local().lessThan(max);
+}
+
 std::vector<uint32_t> sampleVector(int size, uint32_t max) {
   std::vector<uint32_t> out(size);
-  for (int i = 0; i < size; i++) {
-    out[i] = sampleLessThan(max);
-  }
+  CSPRNG::local().lessThan(out.data(), out.size(), max);
   return out;
 }
 
@@ -56,44 +98,108 @@ std::vector<uint32_t> sampleDistinct(int size, uint32_t max) {
 // INTEGER PRF
 ////////////////////////////////////////////////////////////////////////////////
 
-template<>
-uint32_t PRF<uint32_t>::operator()(BitString x, uint32_t max) const {
-  uint32_t output;
-
-  // largest multiple of max within uint32_t
-  uint64_t max_multiple = ((uint64_t) UINT32_MAX + 1) - (((uint64_t) UINT32_MAX + 1) % max);
+namespace {
 
-  // counter added to input so we can get multiple values per `x` (for rejection sampling)
-  uint32_t counter = 0;
-
-  // sample until you get value below max_multiple (to ensure a uniform distribution)
-  while (true) {
-    BitString input = x + BitString::fromUInt(counter, 32);
-    input.resize(BLOCK_SIZE * 8);
-    block b = this->aes.ecbEncBlock(toBlock(input.data()));
-    std::vector<unsigned char> bytes(BLOCK_SIZE);
+// the prf input for `x` (packed into its low `xbits` bits) with the rejection sampling
+//  counter placed right after it, matching the BitString encoding `x + counter`
+block prfInput(uint64_t x, size_t xbits, uint32_t counter) {
+  return xbits == 32 ? toBlock(0, x | ((uint64_t) counter << 32)) : toBlock(counter, x);
+}
 
-    memcpy(bytes.data(), &b, sizeof(block));
+// bounded outputs shared by the batched integer prf evaluations
+class Bounded {
+public:
+  Bounded(uint32_t max)
+    : max(max),
+      max_multiple(((uint64_t) UINT32_MAX + 1) - (((uint64_t) UINT32_MAX + 1) % max)),
+      inverse(UINT64_MAX / max + 1) { }
+
+  // whether the (low 32 bits of the) ciphertext is usable or needs to be resampled
+  bool accept(uint32_t value) const { return value < max_multiple; }
+
+  // value % max without a division (Lemire et al., "Faster Remainder by Direct
+  //  Computation")
+  uint32_t reduce(uint32_t value) const {
+    return ((__uint128_t) (inverse * value) * max) >> 64;
+  }
+private:
+  uint64_t max;
+  uint64_t max_multiple;
+  uint64_t inverse;
+};
+
+// number of aes blocks encrypted together so the aes-ni pipeline stays full
+const size_t PRF_BATCH = 8;
+
+// evaluate the integer prf on `n` inputs packed into `xbits`-bit integers
+void batchBounded(
+  const AES& aes, const uint64_t* x, size_t xbits, size_t n, uint32_t max, uint32_t* out
+) {
+  if (max == 0) {
+    throw std::invalid_argument("[PRF<uint32_t>::operator()] max must be positive");
+  }
+  Bounded bounded(max);
+
+  block in[PRF_BATCH], enc[PRF_BATCH];
+  for (size_t i = 0; i < n; i += PRF_BATCH) {
+    size_t m = std::min(PRF_BATCH, n - i);
+    for (size_t k = 0; k < m; k++) { in[k] = prfInput(x[i + k], xbits, 0); }
+    aes.ecbEncBlocks(in, m, enc);
+
+    for (size_t k = 0; k < m; k++) {
+      uint32_t value;
+      memcpy(&value, &enc[k], sizeof(uint32_t));
+
+      // rejections happen with probability < max / 2³² so handle them one at a time
+      for (uint32_t counter = 1; !bounded.accept(value); counter++) {
+        block b = aes.ecbEncBlock(prfInput(x[i + k], xbits, counter));
+        memcpy(&value, &b, sizeof(uint32_t));
+      }
+      out[i + k] = bounded.reduce(value);
+    }
+  }
+}
 
-    output = BitString(bytes).toUInt();
-    if (output < max_multiple) { break; }
+}
 
-    counter++;
+template<>
+void PRF<uint32_t>::operator()(
+  const uint32_t* x, size_t n, uint32_t max, uint32_t* out
+) const {
+  uint64_t packed[PRF_BATCH];
+  for (size_t i = 0; i < n; i += PRF_BATCH) {
+    size_t m = std::min(PRF_BATCH, n - i);
+    for (size_t k = 0; k < m; k++) { packed[k] = x[i + k]; }
+    batchBounded(this->aes, packed, 32, m, max, out + i);
   }
+}
 
-  return output % max;
+template<>
+void PRF<uint32_t>::operator()(
+  const std::pair<uint32_t, uint32_t>* x, size_t n, uint32_t max, uint32_t* out
+) const {
+  uint64_t packed[PRF_BATCH];
+  for (size_t i = 0; i < n; i += PRF_BATCH) {
+    size_t m = std::min(PRF_BATCH, n - i);
+    for (size_t k = 0; k < m; k++) {
+      packed[k] = x[i + k].first | ((uint64_t) x[i + k].second << 32);
+    }
+    batchBounded(this->aes, packed, 64, m, max, out + i);
+  }
 }
 
 template<>
 uint32_t PRF<uint32_t>::operator()(uint32_t x, uint32_t max) const {
-  return this->operator()(BitString::fromUInt(x, 32), max);
+  uint32_t out;
+  this->operator()(&x, 1, max, &out);
+  return out;
 }
 
 template<>
 uint32_t PRF<uint32_t>::operator()(std::pair<uint32_t, uint32_t> x, uint32_t max) const {
-  return this->operator()(
-    BitString::fromUInt(x.first, 32) + BitString::fromUInt(x.second, 32), max
-  );
+  uint32_t out;
+  this->operator()(&x, 1, max, &out);
+  return out;
 }
 
 template class PRF<uint32_t>;
@@ -103,31 +209,47 @@ template class PRF<uint32_t>;
 ////////////////////////////////////////////////////////////////////////////////
 
 template<>
-BitString PRF<BitString>::operator()(uint32_t x, uint32_t bits) const {
-
+void PRF<BitString>::operator()(
+  const uint32_t* x, size_t n, uint32_t bits, BitString* out
+) const {
   // output is sized to the minimum multiple of the block size we need
   const size_t blocks = (((bits + 7) / 8) + BLOCK_SIZE - 1) / BLOCK_SIZE;
   std::vector<block> output(blocks);
 
-  this->aes.ecbEncCounterMode((uint64_t) x << 32, blocks, output.data());
-  std::vector<unsigned char> bytes(output.size() * BLOCK_SIZE);
-
-  unsigned char* ptr = bytes.data();
-  for (auto i = 0; i < output.size(); i++) {
-    memcpy(ptr, output[i].data(), sizeof(block));
+  for (size_t i = 0; i < n; i++) {
+    this->aes.ecbEncCounterMode((uint64_t) x[i] << 32, blocks, output.data());
+    out[i] = BitString(reinterpret_cast<unsigned char*>(output.data()), bits);
   }
+}
 
-  return BitString(ptr, bits);
+template<>
+BitString PRF<BitString>::operator()(uint32_t x, uint32_t bits) const {
+  BitString out;
+  this->operator()(&x, 1, bits, &out);
+  return out;
 }
 
 template<>
-BitString PRF<BitString>::operator()(BitString x, uint32_t max) const {
-  throw std::runtime_error("not implemented");
+void PRF<BitString>::operator()(
+  const std::pair<uint32_t, uint32_t>* x, size_t n, uint32_t bits, BitString* out
+) const {
+  const size_t blocks = (((bits + 7) / 8) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  std::vector<block> input(blocks), output(blocks);
+
+  for (size_t i = 0; i < n; i++) {
+    // the pair fills the low word and the block index the high one (as for the integer prf)
+    uint64_t packed = x[i].first | ((uint64_t) x[i].second << 32);
+    for (size_t j = 0; j < blocks; j++) { input[j] = toBlock(j, packed); }
+    this->aes.ecbEncBlocks(input.data(), blocks, output.data());
+    out[i] = BitString(reinterpret_cast<unsigned char*>(output.data()), bits);
+  }
 }
 
 template<>
-BitString PRF<BitString>::operator()(std::pair<uint32_t, uint32_t> x, uint32_t max) const {
-  throw std::runtime_error("not implemented");
+BitString PRF<BitString>::operator()(std::pair<uint32_t, uint32_t> x, uint32_t bits) const {
+  BitString out;
+  this->operator()(&x, 1, bits, &out);
+  return out;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -198,8 +320,8 @@ GaussianSampler::GaussianSampler(std::string filename) {
 }
 
 int GaussianSampler::get(bool zero) const {
-  // TODO: LAMBDA is more than we need here; connected to bug in BitString::sample()
-  BitString randomness = BitString::sample(LAMBDA);
+  // `bits` bits for the magnitude plus one more for the sign
+  BitString randomness = BitString::sample(this->bits + 1);
   BitString uniform_sample = randomness[{0, this->bits}];
 
   const std::vector<BitString>* dist = (zero ? &this->zero_dist : &this->one_dist);
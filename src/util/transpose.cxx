@@ -1,120 +1,213 @@
 #include <algorithm>
-#include <cassert>
-#include <emmintrin.h>
+#include <atomic>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
+#include <immintrin.h>
+
 #include "pkg/pprf.hpp"
 #include "util/bitstring.hpp"
 #include "util/concurrency.hpp"
 #include "util/params.hpp"
 
-// taken from
-// https://mischasan.wordpress.com/2011/10/03/the-full-sse2-bit-matrix-transpose-routine/
-void sse_trans(uint8_t const *inp, uint8_t *out, int nrows, int ncols) {
-#   define INP(x,y) inp[(x)*ncols/8 + (y)/8]
-#   define OUT(x,y) out[(y)*nrows/8 + (x)/8]
-  int rr, cc, i, h;
-  union { __m128i x; uint8_t b[16]; } tmp;
-  assert(nrows % 8 == 0 && ncols % 8 == 0);
-
-  // Do the main body in 16x8 blocks:
-  for (rr = 0; rr <= nrows - 16; rr += 16) {
-    for (cc = 0; cc < ncols; cc += 8) {
-      for (i = 0; i < 16; ++i) {
-        tmp.b[i] = INP(rr + i, cc);
-      }
-      for (i = 8; --i >= 0; tmp.x = _mm_slli_epi64(tmp.x, 1)) {
-        *(uint16_t*)&OUT(rr,cc+i)= _mm_movemask_epi8(tmp.x);
+////////////////////////////////////////////////////////////////////////////////
+// TILE KERNELS
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// the matrix is worked through in tiles of 64 rows by 256 columns, held as four 64 × 64
+//  blocks side by side so that tile[i][b] is row i of block b (bits packed little-endian)
+const size_t TILE_ROWS = 64;
+const size_t TILE_BLOCKS = 4;
+
+using Tile = uint64_t[TILE_ROWS][TILE_BLOCKS];
+
+// transposes each block of the tile in place, so afterwards tile[j][b] holds column j of
+//  block b; each round swaps the top right and bottom left quarters of ever smaller
+//  sub-blocks
+using TileKernel = void (*)(Tile& tile);
+
+const uint64_t SWAP_MASKS[6] = {
+  0x00000000ffffffffull, 0x0000ffff0000ffffull, 0x00ff00ff00ff00ffull,
+  0x0f0f0f0f0f0f0f0full, 0x3333333333333333ull, 0x5555555555555555ull
+};
+
+void transposeScalar(Tile& tile) {
+  for (size_t round = 0, s = 32; round < 6; round++, s /= 2) {
+    const uint64_t mask = SWAP_MASKS[round];
+    for (size_t k = 0; k < TILE_ROWS; k = (k + s + 1) & ~s) {
+      for (size_t b = 0; b < TILE_BLOCKS; b++) {
+        uint64_t t = ((tile[k][b] >> s) ^ tile[k + s][b]) & mask;
+        tile[k + s][b] ^= t;
+        tile[k][b] ^= t << s;
       }
     }
   }
-  if (rr == nrows) return;
-
-  // The remainder is a block of 8x(16n+8) bits (n may be 0).
-  //  Do a PAIR of 8x8 blocks in each step:
-  for (cc = 0; cc <= ncols - 16; cc += 16) {
-    for (i = 0; i < 8; ++i) {
-      tmp.b[i] = h = *(uint16_t const*)&INP(rr + i, cc);
-      tmp.b[i + 8] = h >> 8;
-    }
-    for (i = 8; --i >= 0; tmp.x = _mm_slli_epi64(tmp.x, 1)) {
-      OUT(rr, cc + i) = h = _mm_movemask_epi8(tmp.x);
-      OUT(rr, cc + i + 8) = h >> 8;
+}
+
+// the avx2 version does the same swaps on all four blocks at once
+__attribute__((target("avx2")))
+void transposeAVX2(Tile& tile) {
+  __m256i rows[TILE_ROWS];
+  for (size_t i = 0; i < TILE_ROWS; i++) {
+    rows[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile[i]));
+  }
+  for (size_t round = 0, s = 32; round < 6; round++, s /= 2) {
+    const __m256i mask = _mm256_set1_epi64x(SWAP_MASKS[round]);
+    const __m128i shift = _mm_cvtsi32_si128(s);
+    for (size_t k = 0; k < TILE_ROWS; k = (k + s + 1) & ~s) {
+      __m256i t = _mm256_and_si256(
+        _mm256_xor_si256(_mm256_srl_epi64(rows[k], shift), rows[k + s]), mask
+      );
+      rows[k + s] = _mm256_xor_si256(rows[k + s], t);
+      rows[k] = _mm256_xor_si256(rows[k], _mm256_sll_epi64(t, shift));
     }
   }
-  if (cc == ncols) return;
+  for (size_t i = 0; i < TILE_ROWS; i++) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile[i]), rows[i]);
+  }
+}
 
-  //  Do the remaining 8x8 block:
-  for (i = 0; i < 8; ++i)
-    tmp.b[i] = INP(rr + i, cc);
-  for (i = 8; --i >= 0; tmp.x = _mm_slli_epi64(tmp.x, 1))
-    OUT(rr, cc + i) = _mm_movemask_epi8(tmp.x);
+// pick the avx2 kernel if the cpu supports it (decided once at first use)
+TileKernel tileKernel() {
+  static const TileKernel selected = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? transposeAVX2 : transposeScalar;
+  }();
+  return selected;
 }
 
-void transpose(
-  std::vector<BitString*>& input, std::vector<uint8_t*>& output, size_t nrows, size_t ncols
+// transpose the `nrows` × `ncols` matrix in row blocks [`rbStart`, `rbEnd`) where
+//  `load(r, w)` gives word `w` of row `r` and `store(c, rb, word)` takes the 64 bits of
+//  column `c` in row block `rb`; ragged edges are padded out with zeros
+template<typename Load, typename Store>
+void transposeTiles(
+  size_t nrows, size_t ncols, size_t rbStart, size_t rbEnd, Load load, Store store
 ) {
-  std::vector<uint8_t> inp_bytes(nrows * (ncols / 8));
-
-  size_t nbytes = ((ncols + 7) / 8);
-  for (int x = 0; x < nrows; x++) {
-    uint8_t* src = input[x]->data();
-    std::copy(src, src + nbytes, inp_bytes.begin() + (x * nbytes));
-    input[x]->clear();
-  }
+  const TileKernel kernel = tileKernel();
+  const size_t nwords = (ncols + 63) / 64;
+  const uint64_t lastMask = (ncols % 64 == 0) ? ~0ull : (1ull << (ncols % 64)) - 1;
+  alignas(32) Tile tile;
+
+  for (size_t rb = rbStart; rb < rbEnd; rb++) {
+    const size_t rows = std::min(TILE_ROWS, nrows - rb * TILE_ROWS);
+    for (size_t cb = 0; cb < nwords; cb += TILE_BLOCKS) {
+      const size_t blocks = std::min(TILE_BLOCKS, nwords - cb);
+
+      for (size_t i = 0; i < TILE_ROWS; i++) {
+        for (size_t b = 0; b < TILE_BLOCKS; b++) {
+          tile[i][b] = (i < rows && b < blocks) ? load(rb * TILE_ROWS + i, cb + b) : 0;
+        }
+      }
+      if (cb + blocks == nwords) {
+        for (size_t i = 0; i < rows; i++) { tile[i][blocks - 1] &= lastMask; }
+      }
 
-  std::vector<uint8_t> out_bytes(ncols * (nrows / 8));
-  sse_trans(inp_bytes.data(), out_bytes.data(), nrows, ncols);
-  inp_bytes.clear();
+      kernel(tile);
 
-  nbytes = ((nrows + 7) / 8);
-  uint8_t* iter = out_bytes.data();
-  for (int i = 0; i < ncols; i++) {
-    std::copy(iter, iter + nbytes, output[i]);
-    iter += nbytes;
+      for (size_t b = 0; b < blocks; b++) {
+        const size_t base = (cb + b) * 64;
+        for (size_t j = 0; j < 64 && base + j < ncols; j++) {
+          store(base + j, rb, tile[j][b]);
+        }
+      }
+    }
   }
 }
 
-std::vector<BitString> transpose(std::vector<PPRF>& pprfs, const PCGParams& params) {
-  // how many chunks each thread will process
-  const size_t CHUNKS = 4;
-
-  // the size of each chunk
-  const size_t CHUNK_SIZE = params.dual.N() / (THREAD_COUNT * CHUNKS);
-  std::vector<std::vector<BitString*>> in_ptrs(THREAD_COUNT * CHUNKS);
-
-  size_t n = 0;
-  for (const PPRF& pprf : pprfs) {
-    auto image = pprf.getImage();
-    for (size_t i = 0; i < pprf.domain(); i++) {
-      BitString* ptr = &((*image)[i]);
-      in_ptrs[n / CHUNK_SIZE].push_back(ptr);
-      n++;
-      if (n >= params.dual.N()) { break; }
-    }
+// transpose `rows` (each at least `ncols` bits) into `output`, which already holds `ncols`
+//  rows of rows.size() bits; threads split the row blocks so each output word has one writer
+void transposeInto(
+  const std::vector<const uint64_t*>& rows, size_t ncols, std::vector<BitString>& output
+) {
+  const size_t nrows = rows.size();
+  const size_t nblocks = (nrows + TILE_ROWS - 1) / TILE_ROWS;
+
+  std::vector<uint64_t*> out(ncols);
+  for (size_t c = 0; c < ncols; c++) {
+    out[c] = reinterpret_cast<uint64_t*>(output[c].data());
   }
 
-  std::vector<BitString> output(params.primal.k);
   MULTI_TASK([&](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      output[i].resize(params.dual.N());
-    }
-  }, params.primal.k);
+    transposeTiles(
+      nrows, ncols, start, end,
+      [&rows](size_t r, size_t w) { return rows[r][w]; },
+      [&out](size_t c, size_t rb, uint64_t word) { out[c][rb] = word; }
+    );
+  }, nblocks);
+}
 
+// allocate `n` zeroed rows of `size` bits
+std::vector<BitString> zeroRows(size_t n, size_t size) {
+  std::vector<BitString> rows(n);
   MULTI_TASK([&](size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-      std::vector<uint8_t*> out_ptrs;
-      for (BitString& row : output) {
-        out_ptrs.push_back(row.data() + (i * ((CHUNK_SIZE + 7) / 8)));
-      }
-      transpose(in_ptrs[i], out_ptrs, CHUNK_SIZE, params.primal.k);
-      out_ptrs.clear();
-    }
-  }, THREAD_COUNT * CHUNKS);
+    for (size_t i = start; i < end; i++) { rows[i].resize(size); }
+  }, n);
+  return rows;
+}
+
+}
 
-  // free up processed memory
-  for (PPRF& pprf : pprfs) { pprf.clear(); }
+////////////////////////////////////////////////////////////////////////////////
+// TRANSPOSE
+////////////////////////////////////////////////////////////////////////////////
 
+std::vector<BitString> transpose(const std::vector<BitString>& rows, size_t ncols) {
+  std::vector<const uint64_t*> ptrs(rows.size());
+  for (size_t r = 0; r < rows.size(); r++) {
+    if (rows[r].size() < ncols) {
+      throw std::invalid_argument("[transpose] row is shorter than the number of columns");
+    }
+    ptrs[r] = reinterpret_cast<const uint64_t*>(rows[r].data());
+  }
+
+  std::vector<BitString> output = zeroRows(ncols, rows.size());
+  transposeInto(ptrs, ncols, output);
   return output;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// STREAMING
+////////////////////////////////////////////////////////////////////////////////
+
+PPRF::LeafSink transposeSink(std::vector<BitString>& output, const PCGParams& params) {
+  const size_t domainsize = params.dual.blockSize(), N = params.dual.N(), k = params.primal.k;
+  const size_t bytes = (k + 7) / 8;
+
+  return [&output, domainsize, N, k, bytes](
+    size_t tree, size_t offset, const uint8_t* leafs, size_t n
+  ) {
+    size_t start = tree * domainsize + offset;
+    if (start >= N) { return; }
+    n = std::min(n, N - start);
+
+    // words on the edges of the chunk's range may be shared with a chunk on another thread
+    //  so those are updated atomically
+    const size_t shift = start % 64, first = start / 64, last = (start + n - 1) / 64;
+    auto put = [&](size_t c, size_t idx, uint64_t value) {
+      if (value == 0) { return; }
+      uint64_t& word = reinterpret_cast<uint64_t*>(output[c].data())[idx];
+      if (idx == first || idx == last) {
+        std::atomic_ref<uint64_t>(word).fetch_or(value, std::memory_order_relaxed);
+      } else {
+        word |= value;
+      }
+    };
+
+    // leafs are packed in bytes so may not be word aligned
+    transposeTiles(
+      n, k, 0, (n + TILE_ROWS - 1) / TILE_ROWS,
+      [leafs, bytes](size_t r, size_t w) {
+        uint64_t word = 0;
+        std::memcpy(&word, leafs + r * bytes + w * 8, std::min<size_t>(8, bytes - w * 8));
+        return word;
+      },
+      [&](size_t c, size_t rb, uint64_t word) {
+        put(c, first + rb, word << shift);
+        if (shift != 0) { put(c, first + rb + 1, word >> (64 - shift)); }
+      }
+    );
+  };
+}
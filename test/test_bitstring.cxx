@@ -194,6 +194,30 @@ TEST(BitStringTests, Not) {
   EXPECT_EQ(~actual, expected);
 }
 
+TEST(BitStringTests, BitwiseLarge) {
+  // sizes around the vector width and with a partial last word
+  for (size_t size : {63, 64, 255, 256, 1000, 1024 + 65}) {
+    BitString a = BitString::sample(size);
+    BitString b = BitString::sample(size);
+
+    BitString x = a ^ b, n = a & b, o = a | b, c = ~a;
+    for (size_t i = 0; i < size; i++) {
+      ASSERT_EQ(x[i], a[i] ^ b[i]);
+      ASSERT_EQ(n[i], a[i] & b[i]);
+      ASSERT_EQ(o[i], a[i] | b[i]);
+      ASSERT_EQ(c[i], !a[i]);
+    }
+  }
+}
+
+TEST(BitStringTests, CompareIgnoresTrailingBits) {
+  BitString a(std::vector<unsigned char>({0xFF, 0x01}), 9);
+  BitString b(std::vector<unsigned char>({0xFF, 0xFF}), 9);
+  EXPECT_EQ(a, b);
+  EXPECT_FALSE(a < b);
+  EXPECT_FALSE(b < a);
+}
+
 TEST(BitStringTests, InnerProductZeros) {
   BitString a = BitString::sample(128);
   EXPECT_FALSE(a * ~a);
@@ -211,6 +235,41 @@ TEST(BitStringTests, InnerProductFalse) {
   EXPECT_FALSE(a * b);
 }
 
+TEST(BitStringTests, InnerProductIgnoresTrailingBits) {
+  BitString a(std::vector<unsigned char>({0x01, 0xFF}), 9);
+  BitString b(std::vector<unsigned char>({0x01, 0xFE}), 9);
+  EXPECT_TRUE(a * b);
+  EXPECT_EQ(a.weight(), 2);
+}
+
+TEST(BitStringTests, InnerProducts) {
+  const size_t size = 1000;
+  BitString a = BitString::sample(size);
+  std::vector<BitString> others;
+  for (size_t j = 0; j < 11; j++) {
+    others.push_back(BitString::sample(size));
+  }
+
+  BitString products = a.innerProducts(others);
+  ASSERT_EQ(products.size(), others.size());
+  for (size_t j = 0; j < others.size(); j++) {
+    size_t weight = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (a[i] && others[j][i]) { weight++; }
+    }
+    EXPECT_EQ(products[j], weight % 2 == 1);
+  }
+}
+
+TEST(BitStringTests, Weight) {
+  BitString bs = BitString::sample(1000);
+  size_t expected = 0;
+  for (size_t i = 0; i < bs.size(); i++) {
+    if (bs[i]) { expected++; }
+  }
+  EXPECT_EQ(bs.weight(), expected);
+}
+
 TEST(BitStringTests, TensorProduct) {
   BitString a(std::vector<unsigned char>({85}));
   BitString b(std::vector<unsigned char>({63, 143}));
@@ -238,6 +297,45 @@ TEST(BitStringTests, GetSubstring) {
   EXPECT_EQ(actual, expected);
 }
 
+TEST(BitStringTests, ViewUnaligned) {
+  BitString bs = BitString::sample(300);
+
+  for (size_t from : {0, 3, 64, 70, 129}) {
+    for (size_t to : {from, from + 1, from + 64, from + 150, (size_t) 300}) {
+      if (to > bs.size()) { continue; }
+      BitStringView view = bs.view(from, to);
+      ASSERT_EQ(view.size(), to - from);
+      for (size_t i = 0; i < view.size(); i++) {
+        ASSERT_EQ(view[i], bs[from + i]);
+      }
+      ASSERT_EQ(view.toBitString().toString(), bs.toString().substr(from, to - from));
+    }
+  }
+}
+
+TEST(BitStringTests, ViewOperations) {
+  BitString a = BitString::sample(200);
+  BitString b = BitString::sample(200);
+  BitString expected = a[{13, 113}];
+  BitStringView view = a.view(13, 113);
+
+  EXPECT_EQ(view, BitStringView(expected));
+  EXPECT_NE(view, b.view(13, 113));
+  EXPECT_EQ(view.weight(), expected.weight());
+  EXPECT_EQ(view * b.view(50, 150), expected * b[std::make_pair(50, 150)]);
+
+  BitString actual = b[{0, 100}];
+  actual ^= view;
+  EXPECT_EQ(actual, b[std::make_pair(0, 100)] ^ expected);
+}
+
+TEST(BitStringTests, ViewOutOfRange) {
+  BitString bs = BitString::sample(16);
+  EXPECT_THROW(bs.view(0, 17), std::out_of_range);
+  EXPECT_THROW(bs.view(9, 8), std::invalid_argument);
+  EXPECT_THROW(bs.view(0, 8)[8], std::out_of_range);
+}
+
 TEST(BitStringTests, Expand) {
   BitString bs(std::vector<unsigned char>({0xF0}));
   std::vector<unsigned char> expanded = bs.expand();
@@ -332,6 +430,108 @@ TEST(BitStringTests, ConcatInterByte) {
   EXPECT_EQ(actual, expected);
 }
 
+TEST(BitStringTests, ConcatAlignments) {
+  // word aligned, byte aligned, and unaligned starting points
+  for (size_t first : {0, 3, 8, 64, 67, 128}) {
+    for (size_t second : {1, 8, 63, 64, 200}) {
+      BitString a = BitString::sample(first);
+      BitString b = BitString::sample(second);
+
+      BitString actual = a + b;
+      ASSERT_EQ(actual.size(), first + second);
+      ASSERT_EQ(actual.toString(), a.toString() + b.toString());
+    }
+  }
+}
+
+TEST(BitStringTests, ConcatOverStaleBits) {
+  BitString actual(67);
+
+  // raw writes can leave bits set past the end of the bitstring
+  actual.data()[8] = 0xFF;
+  actual += BitString(3);
+
+  EXPECT_EQ(actual.toString(), std::string(64, '0') + "111" + "000");
+}
+
+TEST(BitStringTests, ConcatSelf) {
+  BitString a = BitString::sample(77);
+  BitString expected = a + a;
+  a += a;
+  EXPECT_EQ(a, expected);
+}
+
+TEST(BitStringTests, Move) {
+  BitString a = BitString::sample(300);
+  BitString expected(a);
+  const unsigned char* storage = a.data();
+
+  BitString b(std::move(a));
+  EXPECT_EQ(b, expected);
+  EXPECT_EQ(b.data(), storage);
+  EXPECT_EQ(a.size(), 0);
+
+  a = std::move(b);
+  EXPECT_EQ(a, expected);
+  EXPECT_EQ(a.data(), storage);
+  EXPECT_EQ(b.size(), 0);
+}
+
+TEST(BitStringTests, InlineStorage) {
+  // grow one bit at a time from inline storage out onto the heap and back
+  std::string bits;
+  BitString bs;
+  for (size_t i = 0; i < 300; i++) {
+    bits += (i % 3 == 0) ? '1' : '0';
+    bs += (i % 3 == 0);
+  }
+  EXPECT_EQ(bs.toString(), bits);
+
+  bs.resize(100);
+  EXPECT_EQ(bs.toString(), bits.substr(0, 100));
+
+  // copying & moving strings that fit inline
+  BitString small = BitString::sample(128);
+  BitString copy(small);
+  BitString moved(std::move(copy));
+  EXPECT_EQ(moved, small);
+  EXPECT_EQ(copy.size(), 0);
+
+  // assigning over both kinds of storage
+  BitString large = BitString::sample(1000);
+  moved = large;
+  EXPECT_EQ(moved, large);
+  moved = small;
+  EXPECT_EQ(moved, small);
+  large = std::move(moved);
+  EXPECT_EQ(large, small);
+}
+
+TEST(BitStringTests, RvalueOperatorsReuseStorage) {
+  BitString a = BitString::sample(200);
+  BitString b = BitString::sample(200);
+  BitString c = BitString::sample(200);
+  BitString expected_xor = a ^ b ^ c;
+  BitString expected_and = a & b;
+  BitString expected_or = a | b;
+  BitString expected_cat = a + b;
+
+  BitString t(a);
+  const unsigned char* storage = t.data();
+  BitString result = std::move(t) ^ b ^ c;
+  EXPECT_EQ(result, expected_xor);
+  EXPECT_EQ(result.data(), storage);
+
+  EXPECT_EQ(BitString(a) & b, expected_and);
+  EXPECT_EQ(BitString(a) | b, expected_or);
+  EXPECT_EQ(BitString(a) + b, expected_cat);
+
+  // lvalue operands are left untouched
+  BitString copy(a);
+  BitString unused = a ^ b;
+  EXPECT_EQ(a, copy);
+}
+
 TEST(BitStringTests, ConcatUInts) {
   BitString bs = BitString::fromUInt(24, 13);
   bs += BitString::fromUInt(4201, 13);
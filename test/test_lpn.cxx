@@ -1,9 +1,15 @@
 #include <gtest/gtest.h>
 
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
 // allows us to test protected fields
 #define protected public
 
 #include "pkg/lpn.hpp"
+#include "util/random.hpp"
 
 using namespace LPN;
 
@@ -50,6 +56,60 @@ TEST(LPNTests, PrimalMatrixAccess) {
   }
 }
 
+TEST(LPNTests, PrimalMatrixNonZeroElements) {
+  PrimalParams params(N, k, t, l);
+  BitString key = BitString::sample(128);
+
+  PrimalMatrix A(key, params);
+  for (size_t i = 0; i < N; i++) {
+    std::span<const uint32_t> points = A.getNonZeroElements(i);
+    ASSERT_EQ(points.size(), l);
+    ASSERT_TRUE(std::is_sorted(points.begin(), points.end()));
+    for (uint32_t point : points) { ASSERT_TRUE(A[std::make_pair(i, point)]); }
+  }
+}
+
+TEST(LPNTests, PrimalMatrixImplicit) {
+  PrimalParams params(N, k, t, l);
+  BitString key = BitString::sample(128);
+
+  PrimalMatrix stored(key, params);
+  PrimalMatrix implicit(key, params, true);
+  EXPECT_EQ(implicit.points, nullptr);
+  EXPECT_EQ(implicit.dim(), stored.dim());
+
+  for (size_t i = 0; i < N; i++) {
+    std::span<const uint32_t> expected = stored.getNonZeroElements(i);
+    std::span<const uint32_t> actual = implicit.getNonZeroElements(i);
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin(), actual.end()));
+  }
+
+  BitString s = BitString::sample(k);
+  EXPECT_EQ(implicit * s, stored * s);
+}
+
+TEST(LPNTests, PrimalMatrixDistinctSampling) {
+  // few columns so most rows have collisions, with weights on both sides of the network size
+  for (size_t weight : { 3, 16, 20 }) {
+    PrimalParams params(1000, 24, 10, weight);
+    BitString key = BitString::sample(128);
+    PrimalMatrix A(key, params);
+    PRF<uint32_t> prf(key);
+
+    for (size_t i = 0; i < params.n; i++) {
+      std::vector<uint32_t> expected;
+      for (uint32_t j = 0; expected.size() < weight; j++) {
+        uint32_t point = prf(std::make_pair(uint32_t(i), j), params.k);
+        if (std::find(expected.begin(), expected.end(), point) == expected.end()) {
+          expected.push_back(point);
+        }
+      }
+      std::sort(expected.begin(), expected.end());
+      ASSERT_TRUE(std::ranges::equal(A.getNonZeroElements(i), expected));
+    }
+  }
+}
+
 TEST(LPNTests, DualMatrixDims) {
   DualParams params(N, 4, 32);
   BitString key = BitString::sample(128);
@@ -96,16 +156,16 @@ TEST(LPNTests, PrimalDualMult) {
   PrimalParams pparams(P_HEIGHT, P_WIDTH, P_HEIGHT / 2, P_SPARSITY);
   PrimalMatrix primal = PrimalMatrix::sample(pparams);
 
-  primal.points = std::make_shared<std::vector<std::vector<uint32_t>>>(
-    std::vector<std::vector<uint32_t>>({
-      std::vector<uint32_t>({0, 1}),
-      std::vector<uint32_t>({0, 2}),
-      std::vector<uint32_t>({0, 3}),
-      std::vector<uint32_t>({1, 2}),
-      std::vector<uint32_t>({1, 3}),
-      std::vector<uint32_t>({2, 3}),
-      std::vector<uint32_t>({0, 1}),
-      std::vector<uint32_t>({0, 2}),
+  primal.points = SparseMatrix::store(
+    std::vector<uint32_t>({
+      0, 1,
+      0, 2,
+      0, 3,
+      1, 2,
+      1, 3,
+      2, 3,
+      0, 1,
+      0, 2,
     })
   );
 
@@ -133,6 +193,130 @@ TEST(LPNTests, PrimalDualMult) {
   EXPECT_EQ(B[7].toString(), "01011010");
 }
 
+TEST(LPNTests, MaterializedProduct) {
+  PrimalParams primal(N, k, t, l);
+  DualParams dual(k, 4, 32);
+  PrimalMatrix A = PrimalMatrix::sample(primal);
+  DualMatrix H = DualMatrix::sample(dual);
+
+  MatrixProduct lazy(A, H);
+  MatrixProduct B(A, H);
+  B.materialize(1000);
+  ASSERT_EQ(B.materialized(), 1000);
+  for (size_t i = 0; i < 1100; i++) {
+    ASSERT_EQ(B[i], lazy[i]);
+  }
+
+  // saved rows can be read back into another product over the same matrices
+  BitString key = BitString::sample(256);
+  std::stringstream stream;
+  B.save(stream, key);
+  MatrixProduct loaded(A, H);
+  loaded.load(stream, key);
+  ASSERT_EQ(loaded.materialized(), 1000);
+  for (size_t i = 0; i < 1000; i++) {
+    ASSERT_EQ(loaded[i], lazy[i]);
+  }
+
+  // but not under another key, into a product of another shape or once corrupted
+  std::stringstream other;
+  B.save(other, key);
+  ASSERT_THROW(MatrixProduct(A, H).load(other, BitString::sample(256)), std::domain_error);
+  other.seekg(0);
+  MatrixProduct mismatched(A, DualMatrix::sample(DualParams(k, 2, 32)));
+  ASSERT_THROW(mismatched.load(other, key), std::domain_error);
+  std::string bytes = other.str();
+  bytes[bytes.size() - 10] ^= 1;
+  std::stringstream corrupted(bytes);
+  ASSERT_THROW(MatrixProduct(A, H).load(corrupted, key), std::domain_error);
+
+  // through a cache directory the rows are computed and saved once and then mapped
+  boost::filesystem::path dir =
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  for (size_t run = 0; run < 2; run++) {
+    MatrixProduct cached(A, H);
+    cached.materialize(1000, dir.string(), key);
+    ASSERT_EQ(cached.materialized(), 1000);
+    for (size_t i = 0; i < 1000; i++) {
+      ASSERT_EQ(cached[i], lazy[i]);
+    }
+  }
+  boost::filesystem::remove_all(dir);
+}
+
+TEST(LPNTests, CachedMatrices) {
+  boost::filesystem::path dir =
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  PrimalParams primal(N, k, t, l);
+  DualParams dual(k, 4, 32);
+  BitString pkey = BitString::sample(128), dkey = BitString::sample(128);
+
+  PrimalMatrix A(pkey, primal);
+  DualMatrix H(dkey, dual);
+
+  // the first time writes the files and later times map them
+  for (size_t run = 0; run < 2; run++) {
+    PrimalMatrix cachedA = PrimalMatrix::cached(dir.string(), pkey, primal);
+    DualMatrix cachedH = DualMatrix::cached(dir.string(), dkey, dual);
+    for (size_t i = 0; i < N; i++) {
+      ASSERT_TRUE(std::ranges::equal(cachedA.getNonZeroElements(i), A.getNonZeroElements(i)));
+    }
+    for (size_t i = 0; i < k; i++) { ASSERT_EQ(cachedH[i], H[i]); }
+  }
+  size_t files = std::distance(
+    boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()
+  );
+  ASSERT_EQ(files, 2);
+
+  // a corrupted file fails its checksum and is regenerated
+  for (auto& entry : boost::filesystem::directory_iterator(dir)) {
+    std::ifstream in(entry.path().string(), std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    bytes[100] ^= 0x5a;
+    std::ofstream(entry.path().string(), std::ios::binary) << bytes;
+  }
+  PrimalMatrix cachedA = PrimalMatrix::cached(dir.string(), pkey, primal);
+  DualMatrix cachedH = DualMatrix::cached(dir.string(), dkey, dual);
+  for (size_t i = 0; i < N; i++) {
+    ASSERT_TRUE(std::ranges::equal(cachedA.getNonZeroElements(i), A.getNonZeroElements(i)));
+  }
+  for (size_t i = 0; i < k; i++) { ASSERT_EQ(cachedH[i], H[i]); }
+
+  // other keys get their own files
+  PrimalMatrix::cached(dir.string(), BitString::sample(128), primal);
+  files = std::distance(
+    boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()
+  );
+  ASSERT_EQ(files, 3);
+
+  // a file holding another key's matrix is never used, even under this key's name
+  boost::filesystem::path ours = dir / "ours", theirs = dir / "theirs";
+  PrimalMatrix::cached(ours.string(), pkey, primal);
+  PrimalMatrix::cached(theirs.string(), BitString::sample(128), primal);
+  boost::filesystem::copy_file(
+    boost::filesystem::directory_iterator(theirs)->path(),
+    boost::filesystem::directory_iterator(ours)->path(),
+    boost::filesystem::copy_options::overwrite_existing
+  );
+  cachedA = PrimalMatrix::cached(ours.string(), pkey, primal);
+  for (size_t i = 0; i < N; i++) {
+    ASSERT_TRUE(std::ranges::equal(cachedA.getNonZeroElements(i), A.getNonZeroElements(i)));
+  }
+
+  // a cache directory that can't be created just means nothing is cached
+  boost::filesystem::path blocked = dir / "file";
+  std::ofstream(blocked.string()) << "not a directory";
+  cachedA = PrimalMatrix::cached((blocked / "cache").string(), pkey, primal);
+  cachedH = DualMatrix::cached((blocked / "cache").string(), dkey, dual);
+  for (size_t i = 0; i < N; i++) {
+    ASSERT_TRUE(std::ranges::equal(cachedA.getNonZeroElements(i), A.getNonZeroElements(i)));
+  }
+  for (size_t i = 0; i < k; i++) { ASSERT_EQ(cachedH[i], H[i]); }
+
+  boost::filesystem::remove_all(dir);
+}
+
 TEST(LPNTests, DenseVectorMult) {
   const uint32_t HEIGHT = 8;
   const uint32_t WIDTH  = 4;
@@ -161,20 +345,20 @@ TEST(LPNTests, SparseVectorMult) {
   const uint32_t HEIGHT = 8;
   const uint32_t WIDTH  = 4;
 
-  SparseMatrix matrix(HEIGHT, WIDTH);
+  SparseMatrix matrix(HEIGHT, WIDTH, 2);
 
   BitString vector("1011");
 
-  matrix.points = std::make_shared<std::vector<std::vector<uint32_t>>>(
-    std::vector<std::vector<uint32_t>>({
-      std::vector<uint32_t>({0, 1}),
-      std::vector<uint32_t>({0, 2}),
-      std::vector<uint32_t>({0, 3}),
-      std::vector<uint32_t>({1, 2}),
-      std::vector<uint32_t>({1, 3}),
-      std::vector<uint32_t>({2, 3}),
-      std::vector<uint32_t>({0, 1}),
-      std::vector<uint32_t>({0, 2}),
+  matrix.points = SparseMatrix::store(
+    std::vector<uint32_t>({
+      0, 1,
+      0, 2,
+      0, 3,
+      1, 2,
+      1, 3,
+      2, 3,
+      0, 1,
+      0, 2,
     })
   );
 
@@ -184,3 +368,158 @@ TEST(LPNTests, SparseVectorMult) {
   // I just did this by hand
   ASSERT_EQ(actual.toString(), "10011010");
 }
+
+TEST(LPNTests, DenseGram) {
+  DualParams params(k, 4, 32);
+  BitString key = BitString::sample(128);
+
+  DualMatrix H(key, params);
+  std::vector<BitString> other;
+  for (size_t i = 0; i < 2 * k + 3; i++) {
+    other.push_back(BitString::sample(H.dim().second));
+  }
+
+  DenseMatrix G = H.gram(other);
+  ASSERT_EQ(G.dim(), std::make_pair(k, other.size()));
+  for (size_t i = 0; i < k; i++) {
+    for (size_t j = 0; j < other.size(); j++) {
+      bool expected = H[i] * other[j];
+      ASSERT_EQ(G[std::make_pair(i, j)], expected);
+    }
+  }
+}
+
+TEST(LPNTests, DenseMatrixMult) {
+  // ragged sizes spanning several row blocks and output stripes
+  DenseMatrix left(2100, 77, BitString::sample(128));
+  DenseMatrix right(77, 600, BitString::sample(128));
+
+  DenseMatrix product = left * right;
+  ASSERT_EQ(product.dim(), std::make_pair(size_t(2100), size_t(600)));
+  for (size_t i = 0; i < 2100; i += 7) {
+    BitString expected(600);
+    for (size_t j = 0; j < 77; j++) {
+      if (left[std::make_pair(i, j)]) { expected ^= right[j]; }
+    }
+    ASSERT_EQ(product[i], expected);
+  }
+
+  // the transposed product xors together the selected rows
+  BitString vector = BitString::sample(2100);
+  BitString expected(77);
+  for (size_t i = 0; i < 2100; i++) {
+    if (vector[i]) { expected ^= left[i]; }
+  }
+  ASSERT_EQ(left.transposeTimes(vector), expected);
+}
+
+TEST(LPNTests, SumColumns) {
+  DualParams params(k, 4, 32);
+  BitString key = BitString::sample(128);
+  DualMatrix dense(key, params);
+  QuasiCyclicMatrix qc(key, params);
+
+  std::vector<size_t> cols;
+  BitString indicator(params.N());
+  for (size_t j = 0; j < params.t; j++) {
+    cols.push_back(j * params.blockSize() + (j * 37) % params.blockSize());
+    indicator[cols.back()] = 1;
+  }
+
+  ASSERT_EQ(dense.sumColumns(cols), dense * indicator);
+  ASSERT_EQ(qc.sumColumns(cols), qc * indicator);
+}
+
+TEST(LPNTests, DualMatrixColumns) {
+  DualParams params(k, 4, 32);
+  BitString key = BitString::sample(128);
+  DualMatrix rowMajor(key, params);
+  DualMatrix columnMajor(key, params);
+
+  const std::vector<BitString>& columns = columnMajor.columns();
+  ASSERT_EQ(columns.size(), params.N());
+  for (size_t col = 0; col < params.N(); col++) {
+    ASSERT_EQ(columns[col].size(), k);
+    for (size_t i = 0; i < k; i++) {
+      ASSERT_EQ(columns[col][i], rowMajor[std::make_pair(i, col)]);
+    }
+  }
+
+  // only the strips holding the columns are transposed, including when several columns
+  //  share a strip or one is picked twice
+  std::vector<size_t> cols;
+  for (size_t j = 0; j < params.t; j++) { cols.push_back(j * params.blockSize() + j % 5); }
+  cols.push_back(cols[0] + 1);
+  cols.push_back(cols[3]);
+  cols.push_back(params.N() - 1);
+  ASSERT_EQ(rowMajor.sumColumns(cols), rowMajor.DenseMatrix::sumColumns(cols));
+  ASSERT_EQ(columnMajor.sumColumns(cols), rowMajor.sumColumns(cols));
+}
+
+TEST(LPNTests, QuasiCyclicStructure) {
+  // 2.5 blocks so the last one is cut short
+  DualParams params(k, 2.5, 32);
+  BitString key = BitString::sample(128);
+
+  QuasiCyclicMatrix H(key, params);
+  ASSERT_EQ(H.dim(), std::make_pair(k, params.N()));
+
+  BitString first = H[0];
+  for (size_t i = 0; i < k; i++) {
+    BitString row = H[i];
+    ASSERT_EQ(row.size(), params.N());
+    for (size_t col = 0; col < params.N(); col++) {
+      // each block is a rotation of its first row (which is cut short in the last block)
+      size_t block = col / k, from = block * k + (col % k + k - i) % k;
+      if (from < params.N()) { ASSERT_EQ(row[col], first[from]); }
+      ASSERT_EQ(H[std::make_pair(i, col)], row[col]);
+    }
+  }
+  EXPECT_NE(H[0], QuasiCyclicMatrix(BitString::sample(128), params)[0]);
+}
+
+TEST(LPNTests, QuasiCyclicRowsInPlace) {
+  // blocks that don't line up with words and a last block cut short
+  DualParams params(100, 2.5, 10);
+  QuasiCyclicMatrix H = QuasiCyclicMatrix::sample(params);
+  BitString vector = BitString::sample(params.N());
+  BitString product = H * vector;
+
+  for (size_t i = 0; i < params.n; i++) {
+    BitString acc = BitString::sample(params.N());
+    BitString expected = acc ^ H[i];
+    H.xorRow(i, acc);
+    ASSERT_EQ(acc, expected);
+    ASSERT_EQ(product[i], H[i] * vector);
+  }
+}
+
+TEST(LPNTests, QuasiCyclicMultAndGram) {
+  DualParams params(k, 4, 32);
+  BitString key = BitString::sample(128);
+
+  QuasiCyclicMatrix H(key, params);
+  BitString vector = BitString::sample(params.N());
+  BitString product = H * vector;
+  for (size_t i = 0; i < k; i++) {
+    ASSERT_EQ(product[i], H[i] * vector);
+  }
+
+  std::vector<BitString> other;
+  for (size_t i = 0; i < 70; i++) { other.push_back(BitString::sample(params.N())); }
+  DenseMatrix G = H.gram(other);
+  for (size_t i = 0; i < k; i++) {
+    for (size_t j = 0; j < other.size(); j++) {
+      ASSERT_EQ(G[std::make_pair(i, j)], H[i] * other[j]);
+    }
+  }
+
+  // the product with a sparse matrix combines rows of the structured matrix
+  PrimalMatrix A = PrimalMatrix::sample(PrimalParams(N, k, t, l));
+  MatrixProduct B(A, std::make_shared<QuasiCyclicMatrix>(H));
+  for (size_t i = 0; i < 64; i++) {
+    BitString expected(params.N());
+    for (uint32_t point : A.getNonZeroElements(i)) { expected ^= H[point]; }
+    ASSERT_EQ(B[i], expected);
+  }
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <boost/filesystem.hpp>
+
 // allows us to test private methods
 #define protected public
 #define private public
@@ -10,6 +12,7 @@
 #include "test/fixtures.cxx"
 
 #include "util/defines.hpp"
+#include "util/transpose.hpp"
 
 class PCGTests : public NetworkTest { };
 
@@ -73,3 +76,165 @@ TEST_F(PCGTests, PCGNumOTs) {
   EXPECT_EQ(0, bob_srots.remaining());
   EXPECT_EQ(0, bob_rrots.remaining());
 }
+
+TEST(PCGExpandTests, GramMatchesDirect) {
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 1 << 7, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  PCG::Sender pcg(params);
+  pcg.init();
+
+  // stand in for the (ε ⊗ s) matrix that finalize would produce
+  for (size_t i = 0; i < params.primal.k; i++) {
+    pcg.eXs_matrix.push_back(BitString::sample(params.dual.N()));
+  }
+
+  EXPECT_EQ(pcg.expandGram(), pcg.expandDirect());
+}
+
+TEST(PCGExpandTests, QuasiCyclicGramMatchesDirect) {
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 1 << 7, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  params.dualCode = DualCode::QUASI_CYCLIC;
+  PCG::Sender pcg(params);
+  pcg.init();
+
+  for (size_t i = 0; i < params.primal.k; i++) {
+    pcg.eXs_matrix.push_back(BitString::sample(params.dual.N()));
+  }
+
+  EXPECT_EQ(pcg.expandGram(), pcg.expandDirect());
+}
+
+TEST(PCGExpandTests, CachedInitMatchesFresh) {
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 1 << 7, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  PCG::Sender fresh(params);
+  fresh.init();
+
+  params.materializeProduct = true;
+  params.cacheDir = (
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()
+  ).string();
+
+  // the first init fills the cache and the second maps everything back out of it
+  for (size_t run = 0; run < 2; run++) {
+    PCG::Sender cached(params);
+    cached.init();
+    cached.materializeProduct();
+    ASSERT_EQ(cached.B.materialized(), params.size);
+    for (size_t i = 0; i < params.size; i += 17) {
+      ASSERT_EQ(cached.B[i], fresh.B[i]);
+    }
+  }
+  boost::filesystem::remove_all(params.cacheDir);
+}
+
+TEST(PCGExpandTests, ProductMaterializedOnce) {
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 1 << 7, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  params.expansion = Expansion::DIRECT;
+  params.materializeProduct = true;
+
+  // init() is called again after clear() in a protocol run, so neither computes the rows
+  PCG::Sender pcg(params);
+  pcg.init();
+  ASSERT_EQ(pcg.B.materialized(), 0);
+  pcg.clear();
+  pcg.init();
+  ASSERT_EQ(pcg.B.materialized(), 0);
+
+  // they are only computed by the first expansion and then reused
+  pcg.eXs_matrix = std::vector<BitString>(params.primal.k, BitString(params.dual.N()));
+  pcg.output = BitString(params.size);
+  pcg.expand();
+  ASSERT_EQ(pcg.B.materialized(), params.size);
+  const uint64_t* rows = pcg.B.cache.get();
+  pcg.expand();
+  ASSERT_EQ(pcg.B.cache.get(), rows);
+}
+
+TEST(PCGExpandTests, TransposeSinkMatchesLeafs) {
+  // blocks and a secret size that don't line up with bytes or words
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 100, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  const size_t domainsize = params.dual.blockSize();
+  const size_t depth = (size_t) ceil(log2(domainsize));
+
+  std::vector<PPRF> streamed, expanded;
+  for (size_t i = 0; i < params.dual.t; i++) {
+    std::vector<BitString> keys;
+    for (size_t l = 0; l < depth; l++) { keys.push_back(BitString::sample(LAMBDA)); }
+    keys.push_back(BitString::sample(params.primal.k));
+    uint32_t x = sampleLessThan(domainsize);
+    streamed.emplace_back(keys, x, params.primal.k, domainsize);
+    expanded.emplace_back(keys, x, params.primal.k, domainsize);
+  }
+
+  std::vector<BitString> columns(params.primal.k, BitString(params.dual.N()));
+  PPRF::expand(streamed, transposeSink(columns, params));
+  PPRF::expand(expanded);
+
+  for (size_t i = 0; i < params.dual.N(); i++) {
+    BitString leaf = expanded[i / domainsize](i % domainsize);
+    for (size_t r = 0; r < params.primal.k; r++) {
+      ASSERT_EQ(columns[r][i], leaf[r]);
+    }
+  }
+}
+
+TEST(PCGExpandTests, TransposeRagged) {
+  // neither dimension fills out a tile
+  std::vector<std::pair<size_t, size_t>> shapes = { {300, 200}, {64, 256}, {7, 1} };
+  for (auto [nrows, ncols] : shapes) {
+    std::vector<BitString> rows;
+    for (size_t r = 0; r < nrows; r++) { rows.push_back(BitString::sample(ncols + 5)); }
+
+    std::vector<BitString> cols = transpose(rows, ncols);
+    ASSERT_EQ(cols.size(), ncols);
+    for (size_t c = 0; c < ncols; c++) {
+      ASSERT_EQ(cols[c].size(), nrows);
+      for (size_t r = 0; r < nrows; r++) {
+        ASSERT_EQ(cols[c][r], rows[r][c]);
+      }
+    }
+  }
+}
+
+TEST(PCGExpandTests, SenderSinkMatchesLeafs) {
+  PCGParams params(
+    BitString::sample(LAMBDA), 1 << 12, 100, 1 << 6, 5,
+    BitString::sample(LAMBDA), 4, 1 << 3
+  );
+  const size_t domainsize = params.dual.blockSize();
+
+  std::vector<PPRF> sunk, held;
+  std::vector<BitString> columns(params.primal.k, BitString(params.dual.N()));
+  PPRF::LeafSink sink = transposeSink(columns, params);
+  for (size_t i = 0; i < params.dual.t; i++) {
+    BitString key = BitString::sample(LAMBDA);
+    sunk.emplace_back(key, params.primal.k, domainsize, sink, i);
+    held.emplace_back(key, params.primal.k, domainsize);
+  }
+
+  for (size_t i = 0; i < params.dual.N(); i++) {
+    BitString leaf = held[i / domainsize](i % domainsize);
+    for (size_t r = 0; r < params.primal.k; r++) {
+      ASSERT_EQ(columns[r][i], leaf[r]);
+    }
+  }
+
+  // the sums sent to the receiver don't depend on where the leafs went
+  for (size_t i = 0; i < params.dual.t; i++) {
+    EXPECT_EQ(sunk[i].levels, held[i].levels);
+  }
+}
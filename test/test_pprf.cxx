@@ -132,6 +132,96 @@ TEST_F(PPRFTests, SendAndReceive) {
   }
 }
 
+TEST_F(PPRFTests, ExpandTogetherMatchesExpandEach) {
+  const size_t depth = 6;
+  const size_t domainsize = 50;
+  const size_t outsize = 200;
+
+  // counts that don't split evenly across threads for most core counts
+  for (size_t n : { 1, 13, 33, 97 }) {
+    std::vector<PPRF> together, each;
+    for (size_t i = 0; i < n; i++) {
+      std::vector<BitString> keys;
+      for (size_t l = 0; l < depth; l++) { keys.push_back(BitString::sample(LAMBDA)); }
+      keys.push_back(BitString::sample(outsize));
+      uint32_t x = sampleLessThan(domainsize);
+      together.emplace_back(keys, x, outsize, domainsize);
+      each.emplace_back(keys, x, outsize, domainsize);
+    }
+
+    PPRF::expand(together);
+    for (size_t i = 0; i < n; i++) {
+      each[i].expand();
+      for (size_t x = 0; x < domainsize; x++) {
+        ASSERT_EQ(together[i](x), each[i](x));
+      }
+    }
+  }
+}
+
+TEST_F(BitPPRFTests, ExpandTogetherMatchesExpandEach) {
+  // more trees than are interleaved at once
+  const size_t n = 37;
+  const size_t depth = 7;
+
+  std::vector<BitPPRF> together, each;
+  for (size_t i = 0; i < n; i++) {
+    std::vector<BitString> keys;
+    for (size_t l = 0; l < depth - 1; l++) { keys.push_back(BitString::sample(LAMBDA)); }
+    keys.push_back(BitString::sample(2));
+    uint32_t x = sampleLessThan(1 << depth);
+    together.emplace_back(keys, x);
+    each.emplace_back(keys, x);
+  }
+
+  BitPPRF::expand(together);
+  for (size_t i = 0; i < n; i++) {
+    each[i].expand();
+    ASSERT_EQ(together[i].image(), each[i].image());
+  }
+}
+
+TEST_F(PPRFTests, KeyTooLarge) {
+  EXPECT_THROW(PPRF(BitString::sample(2 * LAMBDA), LAMBDA, LAMBDA), std::invalid_argument);
+  EXPECT_THROW(BitPPRF(BitString::sample(2 * LAMBDA), LAMBDA), std::invalid_argument);
+}
+
+TEST_F(PPRFTests, SendAndReceiveShortKeys) {
+  // keys that don't fill a block and a domain that isn't a power of two
+  const size_t batchsize = 16;
+  const size_t keysize = 100;
+  const size_t outsize = 300;
+  const size_t domainsize = 300;
+
+  auto [srots, rrots] = ROT::mocked(batchsize * ((size_t) ceil(log2(domainsize)) + 1));
+
+  std::vector<uint32_t> points = sampleVector(batchsize, domainsize);
+  std::vector<PPRF> sender = PPRF::sample(batchsize, keysize, outsize, domainsize);
+  BitString payload = BitString::sample(outsize);
+
+  auto results = this->launch(
+    [&](Channel channel) -> bool {
+      PPRF::send(sender, payload, channel, srots);
+      return true;
+    },
+    [&](Channel channel) -> std::vector<PPRF> {
+      return PPRF::receive(points, keysize, outsize, domainsize, channel, rrots);
+    }
+  );
+  std::vector<PPRF> receiver = results.second;
+
+  for (size_t i = 0; i < sender.size(); i++) {
+    receiver[i].expand();
+    for (size_t x = 0; x < domainsize; x++) {
+      if (x == points[i]) {
+        EXPECT_EQ(sender[i](x) ^ receiver[i](x), payload);
+      } else {
+        EXPECT_EQ(sender[i](x), receiver[i](x));
+      }
+    }
+  }
+}
+
 TEST_F(BitPPRFTests, SameKeySameImage) {
   BitString key = BitString::sample(LAMBDA);
 
@@ -175,3 +265,118 @@ TEST_F(BitPPRFTests, SendAndReceive) {
     EXPECT_EQ(expected, actual);
   }
 }
+
+TEST_F(BitPPRFTests, SendAndReceivePacked) {
+  // deep enough that the leafs are bundles of outputs, with keys that don't fill a block
+  const size_t batchsize = 32;
+  const size_t keysize = 100;
+  const size_t domainsize = 1 << 10;
+
+  auto [srots, rrots] = ROT::mocked(batchsize * ((size_t) ceil(log2(domainsize))));
+
+  std::vector<uint32_t> points = sampleVector(batchsize, domainsize);
+  BitString payloads = BitString::sample(batchsize);
+  std::vector<BitPPRF> sender = BitPPRF::sample(batchsize, keysize, domainsize);
+
+  auto results = this->launch(
+    [&](Channel channel) -> bool {
+      BitPPRF::send(sender, payloads, channel, srots);
+      return true;
+    },
+    [&](Channel channel) -> std::vector<BitPPRF> {
+      return BitPPRF::receive(points, keysize, domainsize, channel, rrots);
+    }
+  );
+  std::vector<BitPPRF> receiver = results.second;
+
+  BitPPRF::expand(receiver);
+  for (size_t i = 0; i < batchsize; i++) {
+    ASSERT_EQ(receiver[i].domain(), sender[i].domain());
+    BitString expected(domainsize);
+    expected[points[i]] = payloads[i];
+    EXPECT_EQ(expected, sender[i].image() ^ receiver[i].image());
+  }
+}
+
+TEST_F(PPRFTests, HalfTreeSendAndReceive) {
+  const size_t batchsize = 16;
+  const size_t keysize = 100;
+  const size_t outsize = LAMBDA;
+  const size_t domainsize = 300;
+
+  auto [srots, rrots] = ROT::mocked(batchsize * ((size_t) ceil(log2(domainsize)) + 1));
+
+  std::vector<uint32_t> points = sampleVector(batchsize, domainsize);
+  std::vector<PPRF> sender = PPRF::sample(
+    batchsize, keysize, outsize, domainsize, TreeMode::HALFTREE
+  );
+  BitString payload = BitString::sample(outsize);
+
+  auto results = this->launch(
+    [&](Channel channel) -> bool {
+      PPRF::send(sender, payload, channel, srots);
+      return true;
+    },
+    [&](Channel channel) -> std::vector<PPRF> {
+      return PPRF::receive(
+        points, keysize, outsize, domainsize, channel, rrots, TreeMode::HALFTREE
+      );
+    }
+  );
+  std::vector<PPRF> receiver = results.second;
+
+  PPRF::expand(receiver);
+  for (size_t i = 0; i < sender.size(); i++) {
+    for (size_t x = 0; x < domainsize; x++) {
+      if (x == points[i]) {
+        EXPECT_EQ(sender[i](x) ^ receiver[i](x), payload);
+      } else {
+        EXPECT_EQ(sender[i](x), receiver[i](x));
+      }
+    }
+  }
+}
+
+TEST_F(BitPPRFTests, HalfTreeSendAndReceive) {
+  const size_t batchsize = 32;
+
+  // both the plain and the packed trees
+  for (size_t domainsize : { size_t(LAMBDA), size_t(1) << 10 }) {
+    auto [srots, rrots] = ROT::mocked(batchsize * ((size_t) ceil(log2(domainsize))));
+
+    std::vector<uint32_t> points = sampleVector(batchsize, domainsize);
+    BitString payloads = BitString::sample(batchsize);
+    std::vector<BitPPRF> sender = BitPPRF::sample(
+      batchsize, LAMBDA, domainsize, TreeMode::HALFTREE
+    );
+
+    auto results = this->launch(
+      [&](Channel channel) -> bool {
+        BitPPRF::send(sender, payloads, channel, srots);
+        return true;
+      },
+      [&](Channel channel) -> std::vector<BitPPRF> {
+        return BitPPRF::receive(
+          points, LAMBDA, domainsize, channel, rrots, TreeMode::HALFTREE
+        );
+      }
+    );
+    std::vector<BitPPRF> receiver = results.second;
+
+    BitPPRF::expand(receiver);
+    for (size_t i = 0; i < batchsize; i++) {
+      BitString expected(domainsize);
+      expected[points[i]] = payloads[i];
+      EXPECT_EQ(expected, sender[i].image() ^ receiver[i].image());
+    }
+  }
+}
+
+TEST_F(BitPPRFTests, ModesDiffer) {
+  BitString key = BitString::sample(LAMBDA);
+
+  BitPPRF ggm(key, 1 << 10);
+  BitPPRF halftree(key, 1 << 10, TreeMode::HALFTREE);
+  EXPECT_NE(ggm.image(), halftree.image());
+  EXPECT_EQ(halftree.image(), BitPPRF(key, 1 << 10, TreeMode::HALFTREE).image());
+}
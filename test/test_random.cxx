@@ -14,6 +14,52 @@ TEST(TestRandom, SampleLessThan) {
   EXPECT_NE(a, b);
 }
 
+TEST(TestRandom, SampleVectorUniform) {
+  const uint32_t max = 10;
+  const size_t TESTS = 100000;
+  std::vector<uint32_t> samples = sampleVector(TESTS, max);
+
+  std::vector<size_t> counts(max);
+  for (uint32_t x : samples) {
+    ASSERT_LT(x, max);
+    counts[x]++;
+  }
+
+  // each bucket expects 10000 with a standard deviation of ~95
+  for (size_t count : counts) {
+    EXPECT_GT(count, 9500);
+    EXPECT_LT(count, 10500);
+  }
+}
+
+TEST(TestRandom, SampleLessThanZero) {
+  EXPECT_THROW(sampleLessThan(0), std::invalid_argument);
+}
+
+TEST(TestRandom, SampleBitsUniform) {
+  // odd sizes used to leave the high bits biased
+  const size_t TESTS = 10000;
+  for (size_t size : {9, 13, 128}) {
+    std::vector<size_t> ones(size);
+    for (size_t t = 0; t < TESTS; t++) {
+      BitString bs = BitString::sample(size);
+      ASSERT_EQ(bs.size(), size);
+      for (size_t i = 0; i < size; i++) { ones[i] += bs[i]; }
+    }
+    for (size_t i = 0; i < size; i++) {
+      EXPECT_GT(ones[i], 4700) << "bit " << i << " of " << size;
+      EXPECT_LT(ones[i], 5300) << "bit " << i << " of " << size;
+    }
+  }
+}
+
+TEST(TestRandom, CSPRNGFill) {
+  std::vector<unsigned char> a(1000), b(1000);
+  CSPRNG::local().fill(a.data(), a.size());
+  CSPRNG::local().fill(b.data(), b.size());
+  EXPECT_NE(a, b);
+}
+
 TEST(TestRandom, BitSampler) {
   BitSampler sampler;
 
@@ -144,6 +190,90 @@ TEST(PRFTests, PairEvalSimilarInputsVeryDifferentOutputs) {
   EXPECT_GT(diffs.weight(), 4);
 }
 
+namespace {
+
+// the integer prf computed the slow way: encrypt `x` followed by a 32-bit counter as a
+//  BitString, rejection sample, then reduce with a plain modulo
+uint32_t referencePRF(const BitString& key, const BitString& x, uint32_t max) {
+  osuCrypto::AES aes(osuCrypto::toBlock(key.data()));
+  uint64_t max_multiple = ((uint64_t) UINT32_MAX + 1) - (((uint64_t) UINT32_MAX + 1) % max);
+
+  for (uint32_t counter = 0; ; counter++) {
+    BitString input = x + BitString::fromUInt(counter, 32);
+    input.resize(128);
+    osuCrypto::block b = aes.ecbEncBlock(osuCrypto::toBlock(input.data()));
+
+    std::vector<unsigned char> bytes(sizeof(b));
+    memcpy(bytes.data(), &b, sizeof(b));
+    uint32_t output = BitString(bytes).toUInt();
+    if (output < max_multiple) { return output % max; }
+  }
+}
+
+}
+
+TEST(PRFTests, BatchEvalMatchesReference) {
+  BitString key = BitString::sample(LAMBDA);
+  const size_t TESTS = 1000;
+
+  PRF<uint32_t> prf(key);
+  std::vector<uint32_t> singles(TESTS);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(TESTS);
+  for (size_t i = 0; i < TESTS; i++) {
+    singles[i] = sampleLessThan(1 << 31);
+    pairs[i] = std::make_pair(sampleLessThan(1 << 31), sampleLessThan(1 << 31));
+  }
+
+  // a bound just above 2³¹ rejects about half of all first attempts
+  for (uint32_t max : {uint32_t(10), uint32_t(1) << 20, (uint32_t(1) << 31) + 1}) {
+    std::vector<uint32_t> out(TESTS);
+    prf(singles.data(), TESTS, max, out.data());
+    for (size_t i = 0; i < TESTS; i++) {
+      BitString x = BitString::fromUInt(singles[i], 32);
+      ASSERT_EQ(out[i], referencePRF(key, x, max));
+      ASSERT_EQ(out[i], prf(singles[i], max));
+    }
+
+    prf(pairs.data(), TESTS, max, out.data());
+    for (size_t i = 0; i < TESTS; i++) {
+      BitString x = BitString::fromUInt(pairs[i].first, 32)
+        + BitString::fromUInt(pairs[i].second, 32);
+      ASSERT_EQ(out[i], referencePRF(key, x, max));
+      ASSERT_EQ(out[i], prf(pairs[i], max));
+    }
+  }
+}
+
+TEST(PRFTests, BitStringBatchEval) {
+  BitString key = BitString::sample(LAMBDA);
+  const size_t TESTS = 64;
+  uint32_t bits = 1000;
+
+  PRF<BitString> prf(key);
+  std::vector<uint32_t> in(TESTS);
+  for (size_t i = 0; i < TESTS; i++) { in[i] = i; }
+
+  std::vector<BitString> out(TESTS);
+  prf(in.data(), TESTS, bits, out.data());
+  for (size_t i = 0; i < TESTS; i++) {
+    EXPECT_EQ(out[i], prf(in[i], bits));
+
+    // every block of output should be filled, not just the first
+    EXPECT_GT(out[i][std::make_pair(bits - 128, bits)].weight(), 0);
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(TESTS);
+  for (size_t i = 0; i < TESTS; i++) { pairs[i] = std::make_pair(i, TESTS - i); }
+
+  prf(pairs.data(), TESTS, bits, out.data());
+  for (size_t i = 0; i < TESTS; i++) {
+    EXPECT_EQ(out[i], prf(pairs[i], bits));
+    EXPECT_EQ(out[i].size(), bits);
+    EXPECT_GT(out[i][std::make_pair(bits - 128, bits)].weight(), 0);
+    if (i > 0) { EXPECT_NE(out[i], out[i - 1]); }
+  }
+}
+
 TEST(PRFTests, BitStringSize) {
   BitString key = BitString::sample(LAMBDA);
   uint32_t TESTS = 1024;